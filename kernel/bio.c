@@ -7,7 +7,11 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To get one whose contents will be overwritten in full,
+//     call bfresh, which skips reading it from disk.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To write several buffers at once, call bqueue on each,
+//     then bwait on each.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -96,19 +100,54 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    iosched_add(b, 0);
+    iosched_wait(b);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, without reading
+// it from disk; the caller must overwrite all of b->data.
+struct buf*
+bfresh(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  iosched_add(b, 1);
+  iosched_wait(b);
+}
+
+// Queue a write of b's contents without waiting for it, so
+// that the I/O scheduler can sort and merge it with other
+// queued writes. b must be locked, and must stay locked
+// until bwait(b) has returned.
+void
+bqueue(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bqueue");
+  iosched_add(b, 1);
+}
+
+// Wait for a write started by bqueue() to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  iosched_wait(b);
 }
 
 // Release a locked buffer.
@@ -7,6 +7,9 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *qnext; // I/O scheduler queue, then request run
+  int qwrite;  // queued for a write (vs a read)?
+  int queued;  // waiting in an I/O scheduler queue?
   uchar data[BSIZE];
 };
 
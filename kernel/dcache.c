@@ -0,0 +1,138 @@
+// Directory entry cache.
+//
+// Remembers the outcome of recent directory lookups, so that
+// dirlookup() needn't read through a directory for a name it
+// has looked up before. An entry maps (dev, directory inum,
+// name) to the inum of the name's dirent and its offset in the
+// directory, or records that the name is absent (inum 0).
+//
+// Interface:
+// * dcache_lookup() returns 1 and the cached outcome, if any.
+// * dcache_enter() records an outcome.
+// * dcache_purge() forgets everything about a directory.
+//
+// Callers hold the directory's inode lock, which is what keeps
+// the cache in step with the directory: whatever adds or removes
+// a dirent (dirlink(), sys_unlink()) updates the cache while
+// still holding it. The cache is set-associative, with the
+// least recently used way of a set replaced first.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDSET 64  // sets
+#define NDWAY 4   // entries per set
+
+struct dentry {
+  int valid;
+  uint used;        // dcache.clock when last used
+  uint dev;
+  uint dir;         // inum of the directory
+  char name[DIRSIZ];
+  uint inum;        // 0 if name is not in dir
+  uint off;         // offset of name's dirent in dir
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dentry set[NDSET][NDWAY];
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry*
+getset(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return dcache.set[h % NDSET];
+}
+
+// Find the entry for name in directory dir, or 0.
+// Caller holds dcache.lock.
+static struct dentry*
+find(struct dentry *set, uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = set; d < set + NDWAY; d++)
+    if(d->valid && d->dev == dev && d->dir == dir &&
+       strncmp(d->name, name, DIRSIZ) == 0)
+      return d;
+  return 0;
+}
+
+// Look name up in directory dir on dev. If the outcome is
+// cached, set *inum (0 if name is absent) and *off, and
+// return 1; otherwise return 0.
+int
+dcache_lookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int hit = 0;
+
+  acquire(&dcache.lock);
+  if((d = find(getset(dev, dir, name), dev, dir, name)) != 0){
+    d->used = ++dcache.clock;
+    *inum = d->inum;
+    *off = d->off;
+    hit = 1;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+// Record that name in directory dir on dev has inode inum,
+// in the dirent at offset off, or is absent if inum is 0.
+void
+dcache_enter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *set, *d;
+
+  acquire(&dcache.lock);
+  set = getset(dev, dir, name);
+  if((d = find(set, dev, dir, name)) == 0){
+    d = set;
+    for(struct dentry *e = set; e < set + NDWAY; e++){
+      if(!e->valid){
+        d = e;
+        break;
+      }
+      if(e->used < d->used)
+        d = e;
+    }
+    d->valid = 1;
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+  }
+  d->inum = inum;
+  d->off = off;
+  d->used = ++dcache.clock;
+  release(&dcache.lock);
+}
+
+// Forget all names in directory dir on dev,
+// e.g. because dir has been freed.
+void
+dcache_purge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = &dcache.set[0][0]; d < &dcache.set[NDSET][0]; d++)
+    if(d->valid && d->dev == dev && d->dir == dir)
+      d->valid = 0;
+  release(&dcache.lock);
+}
@@ -2,20 +2,25 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct ukdata;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bfresh(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bqueue(struct buf*);
+void            bwait(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +38,11 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, uint*);
+int             filewritev(struct file*, struct iovec*, int, uint*);
+int             filefcntl(struct file*, int, int);
+int             filesplice(struct file*, struct file*, int);
+int             filevmsplice(struct file*, uint64, int);
 
 // fs.c
 void            fsinit(int);
@@ -52,13 +62,27 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeblocks(int);
+int             putblocks(void);
 void            itrunc(struct inode*);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(uint, uint, char*, uint*, uint*);
+void            dcache_enter(uint, uint, char*, uint, uint);
+void            dcache_purge(uint, uint);
+
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// iosched.c
+void            iosched_init(void);
+void            iosched_add(struct buf*, int);
+void            iosched_wait(struct buf*);
+void            iostat(void);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
@@ -68,14 +92,20 @@ int             kinc(uint64);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
+void            begin_op(int);
 void            end_op(void);
+int             log_maxop(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipefcntl(struct pipe*, int, int);
+int             pipevmsplice(struct pipe*, uint64, int);
+int             pipefill(struct pipe*, struct file*, int);
+int             pipedrain(struct pipe*, struct file*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -102,6 +132,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+void            kthread(char*, void (*)(void));
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
@@ -142,9 +173,11 @@ void            argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+uint64          syscallv(int, uint64*);
 
 // trap.c
 extern uint     ticks;
+extern struct ukdata *ukdata;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
@@ -167,6 +200,8 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+uint64          uvmshare(pagetable_t, uint64, uint64);
+int             uvmremap(pagetable_t, uint64, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -185,7 +220,9 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
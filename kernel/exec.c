@@ -31,7 +31,7 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
+  begin_op(putblocks());
 
   if((ip = namei(path)) == 0){
     end_op();
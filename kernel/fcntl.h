@@ -3,3 +3,13 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  uint iov_len;
+};
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer to at least arg bytes
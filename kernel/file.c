@@ -10,9 +10,12 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 #include "stat.h"
 #include "proc.h"
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -76,7 +79,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    begin_op(putblocks());
     iput(ff.ip);
     end_op();
   }
@@ -101,82 +104,196 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
+// Read from i-node ip into the cnt buffers in iov, at *off,
+// with ip locked once for the lot.
+static int
+readiv(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r = 0, tot = 0;
+
+  ilock(ip);
+  for(i = 0; i < cnt; i++){
+    if((r = readi(ip, 1, (uint64)iov[i].iov_base, *off, iov[i].iov_len)) < 0)
+      break;
+    *off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlock(ip);
+  return r < 0 && tot == 0 ? -1 : tot;
+}
+
+// Write the cnt buffers in iov to i-node ip at *off.
+// Write as much at a time as one transaction can log,
+// reserving only as much log space as each piece needs,
+// so that a big write takes few transactions and a small
+// one leaves room for others. ip is locked once per piece.
+static int
+writeiv(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int i, j, r, n1, max, room, tot = 0;
+  uint done, d;
+
+  max = log_maxop() * BSIZE;
+  while(writeblocks(max) > log_maxop())
+    max -= BSIZE;
+
+  i = 0;
+  done = 0;  // bytes of iov[i] written so far
+  while(i < cnt){
+    if(done == iov[i].iov_len){
+      i++;
+      done = 0;
+      continue;
+    }
+    // this piece: max bytes, from as many buffers as it takes.
+    room = 0;
+    for(j = i, d = done; j < cnt && room < max; j++, d = 0)
+      room += min(iov[j].iov_len - d, max - room);
+
+    begin_op(writeblocks(room));
+    ilock(ip);
+    for(; i < cnt && room > 0; i++, done = 0){
+      n1 = min(iov[i].iov_len - done, room);
+      if((r = writei(ip, 1, (uint64)iov[i].iov_base + done, *off, n1)) > 0){
+        *off += r;
+        tot += r;
+      }
+      if(r != n1){
+        // error from writei
+        iunlock(ip);
+        end_op();
+        return -1;
+      }
+      room -= n1;
+      if((done += n1) < iov[i].iov_len)
+        break;
+    }
+    iunlock(ip);
+    end_op();
+  }
+  return tot;
+}
+
+// Read from file f into the cnt buffers in iov, at *off,
+// or at f's own offset if off is 0. The buffers are user
+// virtual addresses.
 int
-fileread(struct file *f, uint64 addr, int n)
+filereadv(struct file *f, struct iovec *iov, int cnt, uint *off)
 {
-  int r = 0;
+  int i;
 
   if(f->readable == 0)
     return -1;
+  if(f->type == FD_INODE)
+    return readiv(f->ip, iov, cnt, off ? off : &f->off);
+  if(off)
+    return -1;  // pipes and devices have no offset
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-  } else {
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt);
+  if(f->type != FD_DEVICE)
     panic("fileread");
-  }
+  if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+    return -1;
 
-  return r;
+  // a device read may wait for input, and there's no asking a
+  // device whether it has more, so read once, into the first
+  // buffer with room; a second read could block on data that
+  // the caller didn't need.
+  for(i = 0; i < cnt && iov[i].iov_len == 0; i++)
+    ;
+  if(i == cnt)
+    return 0;
+  return devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len);
 }
 
-// Write to file f.
+// Read from file f.
 // addr is a user virtual address.
 int
-filewrite(struct file *f, uint64 addr, int n)
+fileread(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov = { (void*)addr, n };
+
+  return filereadv(f, &iov, 1, 0);
+}
+
+// Write the cnt buffers in iov to file f, at *off,
+// or at f's own offset if off is 0. The buffers are
+// user virtual addresses.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, uint *off)
+{
+  int i, r = 0, tot = 0;
 
   if(f->writable == 0)
     return -1;
+  if(f->type == FD_INODE)
+    return writeiv(f->ip, iov, cnt, off ? off : &f->off);
+  if(off)
+    return -1;  // pipes and devices have no offset
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
-  } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
+  for(i = 0; i < cnt; i++){
+    if(f->type == FD_PIPE){
+      r = pipewrite(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else if(f->type == FD_DEVICE){
+      if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+        return -1;
+      r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+    } else {
+      panic("filewrite");
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    if(r < 0)
+      return -1;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
   }
+  return tot;
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  struct iovec iov = { (void*)addr, n };
 
-  return ret;
+  return filewritev(f, &iov, 1, 0);
 }
 
+// Control file f: cmd is one of the F_ commands in fcntl.h.
+int
+filefcntl(struct file *f, int cmd, int arg)
+{
+  if(f->type == FD_PIPE)
+    return pipefcntl(f->pipe, cmd, arg);
+  return -1;
+}
+
+// Move up to n bytes from file in to file out without
+// copying them through user memory. One of the two must
+// be a pipe and the other an i-node.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipefill(out->pipe, in, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipedrain(in->pipe, out, n);
+  return -1;
+}
+
+// Write to pipe f like filewrite(), but hand whole pages
+// of user memory to the pipe rather than copying them.
+// addr is a user virtual address.
+int
+filevmsplice(struct file *f, uint64 addr, int n)
+{
+  if(f->writable == 0 || f->type != FD_PIPE)
+    return -1;
+  return pipevmsplice(f->pipe, addr, n);
+}
@@ -18,6 +18,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // inode table hash chain
+  struct inode *fnext;  // inode table free list, if ref == 0
+  struct inode *fprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +29,16 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint addrs[NADDRS];
+
+  struct extent ext;  // run bmap() found last (I_EXTENT only),
+  uint extbn;         // and the file block it starts at
+  uint leaf;          // indirect block bmap() used last, if not 0,
+  uint leafbn;        // and the first file block it maps
+  uint goal;          // where bmap() would put a new block
+  uint rsv;           // blocks writei() claimed for bmap(),
+  int nrsv;           // and how many are left
 };
 
 // map major device number to device functions.
@@ -37,6 +37,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int dev);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +46,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -60,33 +63,126 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// The number of free blocks each bitmap block describes,
+// so that balloc() passes over full ones without reading them.
+// Counted by bsuminit() once the log has been recovered, and
+// kept up to date by balloc() and bfree() while they hold
+// the bitmap block's buf.
+#define NBMAP (FSSIZE/BPB + 1)
+struct {
+  struct spinlock lock;
+  int nbmap;
+  int nfree[NBMAP];
+} bsum;
+
+// Number of blocks bitmap block i describes.
+static int
+bmapbits(int i)
+{
+  return min(BPB, sb.size - i*BPB);
+}
+
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int i, bi;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > NBMAP)
+    panic("bsuminit: bitmap");
+  for(i = 0; i < bsum.nbmap; i++){
+    bp = bread(dev, BBLOCK(i*BPB, sb));
+    for(bi = 0; bi < bmapbits(i); bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
+}
+
+// Return the first clear bit in map at or after from
+// and before nbits, or -1. Skips 32 set bits at a time.
+static int
+bfind(uchar *map, int from, int nbits)
+{
+  uint *w = (uint*)map;
+  uint x;
+  int i, bi;
+
+  for(i = from / 32; i * 32 < nbits; i++){
+    x = w[i];
+    if(i == from / 32)
+      x |= (1U << (from % 32)) - 1;  // skip bits before from
+    if(x == 0xffffffff)
+      continue;
+    for(bi = 0; x & (1U << bi); bi++)
+      ;
+    bi += i * 32;
+    return bi < nbits ? bi : -1;
+  }
+  return -1;
+}
+
+// Mark up to n free blocks in use, contiguous and starting at
+// goal or as soon after it as possible (wrapping around), so
+// that files stay contiguous. Returns the first block and sets
+// *len to how many; returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+bmark(uint dev, uint goal, int n, int *len)
 {
-  int b, bi, m;
+  int i, b, bi, k, free;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+  if(goal >= sb.size)
+    goal = 0;
+  // look from goal to the end of its bitmap block, then through
+  // the following ones, and last at the start of goal's.
+  for(i = 0; i <= bsum.nbmap; i++){
+    b = (goal/BPB + i) % bsum.nbmap;
+    acquire(&bsum.lock);
+    free = bsum.nfree[b];
+    release(&bsum.lock);
+    if(free == 0)
+      continue;
+    bp = bread(dev, BBLOCK(b*BPB, sb));
+    bi = bfind(bp->data, i == 0 ? goal % BPB : 0, bmapbits(b));
+    if(bi >= 0){
+      for(k = bi; k < bi + n && k < bmapbits(b); k++){
+        if(bp->data[k/8] & (1 << (k % 8)))
+          break;
+        bp->data[k/8] |= 1 << (k % 8);  // Mark block in use.
       }
+      log_write(bp);
+      acquire(&bsum.lock);
+      bsum.nfree[b] -= k - bi;
+      release(&bsum.lock);
+      brelse(bp);
+      *len = k - bi;
+      return b*BPB + bi;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a zeroed disk block, at goal or as soon after it
+// as possible.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+  int len;
+
+  if((b = bmark(dev, goal, 1, &len)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -101,6 +197,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
   brelse(bp);
 }
 
@@ -115,7 +214,7 @@ bfree(int dev, uint b)
 // sb.inodestart. Each inode has a number, indicating its
 // position on the disk.
 //
-// The kernel keeps a table of in-use inodes in memory
+// The kernel keeps a cache of in-use inodes in memory
 // to provide a place for synchronizing access
 // to inodes used by multiple processes. The in-memory
 // inodes include book-keeping information that is
@@ -134,13 +233,17 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry stays in the table, still
+//   valid, until iget() recycles it for another inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid. An entry whose ref falls to zero keeps
+//   ip->valid, so a later iget() of the same inode needn't
+//   read it again; iput() clears ip->valid only when it
+//   frees the inode on disk, and iget() when it recycles
+//   the entry for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +267,93 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// The table is a hash table on (dev, inum), with a spin-lock
+// per bucket. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold the entry's bucket lock while using any
+// of those fields. Free entries are also on a free list, least
+// recently used last, under itable.freelock; iget() recycles
+// from its end. itable.lock serializes iget()'s misses, so that
+// an inode is never added twice. The table starts with NINODE
+// entries and grows a page of entries at a time when none are
+// free.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
-struct {
+#define NIHASH 31
+
+struct ibucket {
   struct spinlock lock;
+  struct inode *head;       // through ip->hnext
+};
+
+struct {
+  struct spinlock lock;     // serializes misses in iget()
+  struct ibucket bucket[NIHASH];
+
+  // Entries with ref == 0, through fprev/fnext.
+  // freelist.fnext is most recently used, freelist.fprev least.
+  struct spinlock freelock;
+  struct inode freelist;
+
   struct inode inode[NINODE];
 } itable;
 
+static struct ibucket*
+ibucket(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 7 + inum) % NIHASH];
+}
+
+// Put unreferenced ip at the recent end of the free list.
+static void
+freelist_add(struct inode *ip)
+{
+  acquire(&itable.freelock);
+  ip->fnext = itable.freelist.fnext;
+  ip->fprev = &itable.freelist;
+  itable.freelist.fnext->fprev = ip;
+  itable.freelist.fnext = ip;
+  release(&itable.freelock);
+}
+
+// Take ip off the free list, if it is on it.
+static void
+freelist_del(struct inode *ip)
+{
+  acquire(&itable.freelock);
+  if(ip->fnext){
+    ip->fnext->fprev = ip->fprev;
+    ip->fprev->fnext = ip->fnext;
+    ip->fnext = ip->fprev = 0;
+  }
+  release(&itable.freelock);
+}
+
+// Add n entries at ip to the table, as free entries.
+static void
+iadd(struct inode *ip, int n)
+{
+  for(; n > 0; n--, ip++){
+    initsleeplock(&ip->lock, "inode");
+    freelist_add(ip);
+  }
+}
+
 void
 iinit()
 {
   int i = 0;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  initlock(&itable.freelock, "ifree");
+  for(i = 0; i < NIHASH; i++)
+    initlock(&itable.bucket[i].lock, "ibucket");
+  itable.freelist.fnext = &itable.freelist;
+  itable.freelist.fprev = &itable.freelist;
+  iadd(itable.inode, NINODE);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -208,6 +375,8 @@ ialloc(uint dev, short type)
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
+      if(type == T_FILE)
+        dip->flags = I_INLINE | (EXTENTFILES ? I_EXTENT : 0);
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -235,42 +404,107 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
 }
 
-// Find the inode with number inum on device dev
-// and return the in-memory copy. Does not lock
-// the inode and does not read it from disk.
+// Look for inode inum on device dev in bucket bk,
+// and take a reference to it if it is there.
 static struct inode*
-iget(uint dev, uint inum)
+ihit(struct ibucket *bk, uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
-  acquire(&itable.lock);
+  acquire(&bk->lock);
+  for(ip = bk->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        freelist_del(ip);
+      release(&bk->lock);
+      return ip;
+    }
+  }
+  release(&bk->lock);
+  return 0;
+}
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
+// Return a free entry, taken off the free list and out of
+// its bucket, growing the table if there is none.
+// Caller holds itable.lock.
+static struct inode*
+irecycle(void)
+{
+  struct inode *ip;
+  struct ibucket *bk;
+  struct inode **pp;
+
+  for(;;){
+    acquire(&itable.freelock);
+    ip = itable.freelist.fprev;
+    if(ip != &itable.freelist){
+      ip->fnext->fprev = ip->fprev;
+      ip->fprev->fnext = ip->fnext;
+      ip->fnext = ip->fprev = 0;
+    }
+    release(&itable.freelock);
+
+    if(ip == &itable.freelist){
+      if((ip = (struct inode*)kalloc()) == 0)
+        panic("iget: no inodes");
+      memset(ip, 0, PGSIZE);
+      iadd(ip, PGSIZE / sizeof(*ip));
+      continue;
+    }
+    if(ip->inum == 0)  // never used
       return ip;
+
+    bk = ibucket(ip->dev, ip->inum);
+    acquire(&bk->lock);
+    if(ip->ref > 0){
+      // ihit() took it meanwhile.
+      release(&bk->lock);
+      continue;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+    freelist_del(ip);  // in case it was also put back meanwhile
+    for(pp = &bk->head; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+    release(&bk->lock);
+    return ip;
   }
+}
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+// Find the inode with number inum on device dev
+// and return the in-memory copy. Does not lock
+// the inode and does not read it from disk.
+static struct inode*
+iget(uint dev, uint inum)
+{
+  struct ibucket *bk = ibucket(dev, inum);
+  struct inode *ip;
 
-  ip = empty;
+  // Is the inode already in the table?
+  if((ip = ihit(bk, dev, inum)) != 0)
+    return ip;
+
+  // Recycle an inode entry. Look again with itable.lock
+  // held, in case another miss added the inode meanwhile.
+  acquire(&itable.lock);
+  if((ip = ihit(bk, dev, inum)) != 0){
+    release(&itable.lock);
+    return ip;
+  }
+  ip = irecycle();
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  acquire(&bk->lock);
+  ip->hnext = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -281,9 +515,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -308,7 +544,11 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->ext.len = 0;
+    ip->leaf = 0;
+    ip->goal = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -327,8 +567,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the free list and can be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -336,7 +576,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucket(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,8 +587,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -354,11 +598,12 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0)
+    freelist_add(ip);
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,60 +619,269 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The next NINDIRECT^2
+// are reached through the double-indirect block
+// ip->addrs[NDIRECT+1], and the NINDIRECT^3 after those
+// through the triple-indirect block ip->addrs[NDIRECT+2].
+//
+// An I_EXTENT inode lists runs of blocks instead; see fs.h.
+// Files have no holes, so the runs cover the file's blocks
+// in order, and a new block is always appended to the last
+// run if the block after it is free, or else starts a new one.
+//
+// New blocks are allocated at ip->goal, just past the block
+// bmap() returned last, when that is free, so that files
+// written sequentially stay contiguous. Data blocks come from
+// the run writei() claimed for the write, if any.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a data block for ip: the next one writei() claimed,
+// or else a zeroed one near ip->goal.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+dalloc(struct inode *ip)
+{
+  if(ip->nrsv > 0){
+    ip->nrsv--;
+    return ip->rsv++;
+  }
+  return balloc(ip->dev, ip->goal);
+}
+
+// Return the disk block address of the nth block in extent-mapped
+// inode ip, allocating it if bn is just past the last block.
+// returns 0 if out of disk space or extents.
+static uint
+emap(struct inode *ip, uint bn)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint addr, goal, lbn, lastbn;
+  int i, n;
+
+  // Most lookups fall in the same run as the last one.
+  if(ip->ext.len > 0 && bn >= ip->extbn && bn - ip->extbn < ip->ext.len)
+    return ip->ext.start + (bn - ip->extbn);
+
+  // Walk the runs in addrs[], then those in the extent block.
+  bp = 0;
+  last = 0;
+  lastbn = lbn = 0;
+  e = (struct extent*)ip->addrs;
+  n = NIEXTENT;
+  for(i = 0; ; i++, e++){
+    if(i == n){
+      if(bp || ip->addrs[EXTBLOCK] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      e = (struct extent*)bp->data;
+      n = NEXTENT;
+      i = 0;
+    }
+    if(e->len == 0)
+      break;
+    if(bn - lbn < e->len){
+      ip->ext = *e;
+      ip->extbn = lbn;
+      addr = e->start + (bn - lbn);
+      if(bp)
+        brelse(bp);
+      return addr;
+    }
+    last = e;
+    lastbn = lbn;
+    lbn += e->len;
+  }
+  if(bn != lbn)
+    panic("emap: hole");
+
+  goal = last ? last->start + last->len : ip->goal;
+  ip->goal = goal;
+  if((addr = dalloc(ip)) == 0){
+    if(bp)
+      brelse(bp);
+    return 0;
+  }
+  if(last && addr == goal){
+    // grow the last run.
+    last->len++;
+    e = last;
+    lbn = lastbn;
+  } else {
+    if(i == n){
+      // out of extents, or start the extent block.
+      if(bp || (ip->addrs[EXTBLOCK] = balloc(ip->dev, 0)) == 0){
+        bfree(ip->dev, addr);
+        if(bp)
+          brelse(bp);
+        return 0;
+      }
+      bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      e = (struct extent*)bp->data;
+    }
+    e->start = addr;
+    e->len = 1;
+  }
+  ip->ext = *e;
+  ip->extbn = lbn;
+  if(bp){
+    if((uchar*)e >= bp->data && (uchar*)e < bp->data + BSIZE)
+      log_write(bp);
+    brelse(bp);
+  }
+  return addr;
+}
+
+// Return entry i of indirect block addr, allocating a block
+// for it if it is empty: a data block if data is set, or
+// else another indirect block.
+// returns 0 if out of disk space.
+static uint
+ientry(struct inode *ip, uint addr, uint i, int data)
 {
-  uint addr, *a;
   struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = data ? dalloc(ip) : balloc(ip->dev, ip->goal);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in
+// block-mapped inode ip, allocating it if need be.
+// returns 0 if out of disk space.
+static uint
+imap(struct inode *ip, uint bn)
+{
+  uint addr, fbn, span;
+  int level;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = dalloc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
     return addr;
   }
+  fbn = bn;
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+  // Find the tree of indirect blocks holding bn; it is level
+  // deep and maps span blocks.
+  for(level = 1, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT){
+    if(level == NLEVEL)
+      panic("bmap: out of range");
+    bn -= span;
   }
 
-  panic("bmap: out of range");
+  // Sequential access stays within one leaf indirect block
+  // for NINDIRECT blocks; don't walk down to it each time.
+  if(ip->leaf && ip->leafbn == fbn - bn % NINDIRECT)
+    return ientry(ip, ip->leaf, bn % NINDIRECT, 1);
+
+  // Load the root, allocating if necessary, then walk down.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0){
+    addr = balloc(ip->dev, ip->goal);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level-1] = addr;
+  }
+  while(span > NINDIRECT){
+    span /= NINDIRECT;
+    if((addr = ientry(ip, addr, (bn / span) % NINDIRECT, 0)) == 0)
+      return 0;
+  }
+  ip->leaf = addr;
+  ip->leafbn = fbn - bn % NINDIRECT;
+  return ientry(ip, addr, bn % NINDIRECT, 1);
 }
 
-// Truncate inode (discard contents).
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+// returns 0 if out of disk space.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  uint addr;
+
+  if(ip->flags & I_EXTENT)
+    addr = emap(ip, bn);
+  else
+    addr = imap(ip, bn);
+  if(addr)
+    ip->goal = addr + 1;
+  return addr;
+}
+
+// Free indirect block addr, level deep, and the blocks it maps.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
+// Truncate inode (discard contents). An emptied
+// file keeps its data inline again until it grows.
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
   int i, j;
   struct buf *bp;
-  uint *a;
+  struct extent *e;
+
+  if(ip->flags & I_INLINE){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->flags & I_EXTENT){
+    e = (struct extent*)ip->addrs;
+    for(i = 0; i < NIEXTENT; i++)
+      for(j = 0; j < e[i].len; j++)
+        bfree(ip->dev, e[i].start + j);
+    if(ip->addrs[EXTBLOCK]){
+      bp = bread(ip->dev, ip->addrs[EXTBLOCK]);
+      e = (struct extent*)bp->data;
+      for(i = 0; i < NEXTENT; i++)
+        for(j = 0; j < e[i].len; j++)
+          bfree(ip->dev, e[i].start + j);
+      brelse(bp);
+      bfree(ip->dev, ip->addrs[EXTBLOCK]);
+    }
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->ext.len = 0;
+    ip->flags |= I_INLINE;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,17 +890,16 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      ifree(ip->dev, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->leaf = 0;
+  ip->flags &= ~I_DIRINDEX;
+  if(ip->type == T_FILE)
+    ip->flags |= I_INLINE;
 
   ip->size = 0;
   iupdate(ip);
@@ -479,6 +932,12 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & I_INLINE){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -495,6 +954,31 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Move the data of inline file ip out to a block of its own.
+// If that fails (e.g. the disk is full), free whatever was
+// allocated and leave ip inline, as it was.
+static int
+iunline(struct inode *ip)
+{
+  char data[NINLINE];
+  uint size = ip->size;
+  uint flags = ip->flags;
+
+  memmove(data, ip->addrs, size);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->flags &= ~I_INLINE;
+  ip->size = 0;
+  if(writei(ip, 0, (uint64)data, 0, size) != size){
+    itrunc(ip);
+    memmove(ip->addrs, data, size);
+    ip->flags = flags;
+    ip->size = size;
+    iupdate(ip);
+    return -1;
+  }
+  return 0;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -505,20 +989,55 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, have, need;
   struct buf *bp;
+  int len;
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n > NINLINE){
+      if(iunline(ip) < 0)
+        return -1;
+    } else {
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+  }
+
+  // Claim the blocks this write adds to the file up front, as
+  // one run next to the file's last block, instead of one at a
+  // time as the copy reaches them; that way writes to other
+  // files can't land in between. bmap() hands them out.
+  have = (ip->size + BSIZE - 1) / BSIZE;
+  need = (off + n + BSIZE - 1) / BSIZE;
+  if(need > have){
+    if(have > 0)
+      bmap(ip, have - 1);  // sets ip->goal past the last block
+    ip->rsv = bmark(ip->dev, ip->goal, need - have, &len);
+    ip->nrsv = ip->rsv ? len : 0;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(off/BSIZE >= have){
+      // a block new to the file holds nothing worth reading.
+      bp = bfresh(ip->dev, addr);
+      if(m < BSIZE)
+        memset(bp->data, 0, BSIZE);
+    } else {
+      bp = bread(ip->dev, addr);
+    }
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
@@ -527,6 +1046,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     brelse(bp);
   }
 
+  // give back claimed blocks the loop didn't get to.
+  for(; ip->nrsv > 0; ip->nrsv--)
+    bfree(ip->dev, ip->rsv++);
+
   if(off > ip->size)
     ip->size = off;
 
@@ -538,6 +1061,29 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// The most blocks freeing or truncating an inode can add to
+// the log: the inode, and every bitmap block, since its data
+// may be anywhere on the disk. For the last iput() of an
+// inode, and an open() with O_TRUNC.
+int
+putblocks(void)
+{
+  return sb.size / BPB + 2;
+}
+
+// The most blocks writei() of n bytes can add to the log:
+// the data blocks it spans, the inode, an extent block or
+// a chain of indirect blocks per NINDIRECT data blocks, and
+// bitmap blocks, of which the file system has only so many.
+int
+writeblocks(int n)
+{
+  int data = n / BSIZE + 2;
+  int bitmap = min(data + 1, sb.size / BPB + 1);
+
+  return data + 1 + data / NINDIRECT + NLEVEL + bitmap;
+}
+
 // Directories
 
 int
@@ -546,18 +1092,72 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Read block blk of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint blk)
+{
+  uint addr;
+
+  if((addr = bmap(dp, blk)) == 0)
+    panic("dirblock");
+  return bread(dp->dev, addr);
+}
+
+// Find the index entry for hash h in the first block of
+// an indexed directory, held in bp.
+static int
+dxfind(struct buf *bp, uint h)
+{
+  struct dxentry *dx = (struct dxentry*)bp->data + 2;
+  int lo = 0, hi = dx[0].count - 1;
+
+  while(lo < hi){
+    int mid = (lo + hi + 1) / 2;
+    if(dx[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// The directory entry cache has the answer for names
+// looked up recently, found or not. In an indexed
+// directory, only the block the index names is read.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, end, inum;
   struct dirent de;
+  struct buf *bp;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  if(dcache_lookup(dp->dev, dp->inum, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  off = 0;
+  end = dp->size;
+  if(dp->flags & I_DIRINDEX){
+    if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+      end = 2*sizeof(de);
+    } else {
+      bp = dirblock(dp, 0);
+      off = ((struct dxentry*)bp->data + 2)[dxfind(bp, dirhash(name))].blk * BSIZE;
+      brelse(bp);
+      end = off + BSIZE;
+    }
+  }
+
+  for(; off < end; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
@@ -567,10 +1167,177 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcache_enter(dp->dev, dp->inum, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
+  return 0;
+}
+
+// Return the offset of a free dirent in [off, end) of dp, or end.
+static uint
+dirfree(struct inode *dp, uint off, uint end)
+{
+  struct dirent de;
+
+  for(; off < end; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirlink read");
+    if(de.inum == 0)
+      break;
+  }
+  return off;
+}
+
+// Turn dp, a plain directory whose one block is full, into an
+// indexed directory: move everything but "." and ".." to a new
+// block 1, and put an index naming it in block 0.
+static int
+dxinit(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxentry *dx;
+  int n = BSIZE - 2*sizeof(struct dirent);
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  bp = dirblock(dp, 0);
+  memset(mem, 0, BSIZE);
+  memmove(mem, bp->data + 2*sizeof(struct dirent), n);
+  if(writei(dp, 0, (uint64)mem, BSIZE, BSIZE) != BSIZE){
+    brelse(bp);
+    kfree(mem);
+    return -1;
+  }
+  kfree(mem);
+  dx = (struct dxentry*)bp->data + 2;
+  memset(dx, 0, n);
+  dx[0].count = 1;
+  dx[0].blk = 1;
+  log_write(bp);
+  brelse(bp);
+  dp->flags |= I_DIRINDEX;
+  iupdate(dp);
+  dcache_purge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Split the full block named by index entry i of dp, whose
+// first block is held in ibp: names hashing at or above the
+// median move to a new block, with an index entry of its own.
+// Returns 0, 1 if the index is full or the names can't be
+// split, or -1 if out of memory or disk blocks.
+static int
+dxsplit(struct inode *dp, struct buf *ibp, int i)
+{
+  struct dxentry *dx = (struct dxentry*)ibp->data + 2;
+  struct dirent *de, *nde;
+  struct buf *bp;
+  uint hash[DPB], h, s, nblk;
+  int j, k, n;
+  char *mem;
+
+  n = dx[0].count;
+  if(n >= NDXENTRY)
+    return 1;
+  if((mem = kalloc()) == 0)
+    return -1;
+  bp = dirblock(dp, dx[i].blk);
+  de = (struct dirent*)bp->data;
+
+  // the split hash s: the median, or if that is the least
+  // hash the block may hold, the next hash above it.
+  for(j = 0; j < DPB; j++){
+    h = dirhash(de[j].name);
+    for(k = j; k > 0 && hash[k-1] > h; k--)
+      hash[k] = hash[k-1];
+    hash[k] = h;
+  }
+  for(j = DPB/2; j < DPB && hash[j] == dx[i].hash; j++)
+    ;
+  if(j == DPB){
+    brelse(bp);
+    kfree(mem);
+    return 1;
+  }
+  s = hash[j];
+
+  memset(mem, 0, BSIZE);
+  nde = (struct dirent*)mem;
+  for(j = 0; j < DPB; j++)
+    if(dirhash(de[j].name) >= s)
+      *nde++ = de[j];
+  nblk = dp->size / BSIZE;
+  if(writei(dp, 0, (uint64)mem, nblk * BSIZE, BSIZE) != BSIZE){
+    brelse(bp);
+    kfree(mem);
+    return -1;
+  }
+  kfree(mem);
+  for(j = 0; j < DPB; j++)
+    if(dirhash(de[j].name) >= s)
+      memset(&de[j], 0, sizeof(de[j]));
+  log_write(bp);
+  brelse(bp);
+
+  for(j = n; j > i + 1; j--)
+    dx[j] = dx[j-1];
+  dx[i+1].inum = 0;
+  dx[i+1].count = 0;
+  dx[i+1].hash = s;
+  dx[i+1].blk = nblk;
+  dx[0].count = n + 1;
+  log_write(ibp);
+  dcache_purge(dp->dev, dp->inum);
+  return 0;
+}
+
+// Find the offset for a new dirent named name in dp.
+// A plain directory grows into an indexed one once its
+// first block is full. If an indexed directory's index
+// fills up, it reverts to being a plain list of dirents;
+// running out of memory or disk just fails.
+static int
+diroff(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint off, h;
+  int i, r;
+
+  if(!(dp->flags & I_DIRINDEX)){
+    off = dirfree(dp, 0, dp->size);
+    if(off != BSIZE || dp->size != BSIZE){
+      *poff = off;
+      return 0;
+    }
+    if(dxinit(dp) < 0)
+      return -1;
+  }
+
+  h = dirhash(name);
+  bp = dirblock(dp, 0);
+  for(;;){
+    i = dxfind(bp, h);
+    off = ((struct dxentry*)bp->data + 2)[i].blk * BSIZE;
+    if((*poff = dirfree(dp, off, off + BSIZE)) < off + BSIZE){
+      brelse(bp);
+      return 0;
+    }
+    if((r = dxsplit(dp, bp, i)) < 0){
+      brelse(bp);
+      return -1;
+    }
+    if(r > 0)
+      break;
+  }
+  brelse(bp);
+
+  dp->flags &= ~I_DIRINDEX;
+  iupdate(dp);
+  *poff = dirfree(dp, 0, dp->size);
   return 0;
 }
 
@@ -579,7 +1346,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
   struct dirent de;
   struct inode *ip;
 
@@ -589,18 +1356,15 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
+  if(diroff(dp, name, &off) < 0)
+    return -1;
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcache_enter(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
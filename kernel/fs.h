@@ -24,9 +24,17 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NLEVEL 3    // single, double and triple indirect blocks
+#define NADDRS (NDIRECT+NLEVEL)
+#define MAXFILE ((uint64)NDIRECT + NINDIRECT + NINDIRECT*NINDIRECT + \
+                 (uint64)NINDIRECT*NINDIRECT*NINDIRECT)
+
+// Inode flags
+#define I_EXTENT 0x1    // addrs[] holds extents, not block addresses
+#define I_DIRINDEX 0x2  // directory with a hash index in its first block
+#define I_INLINE 0x4    // addrs[] holds the file's data itself
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +43,28 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_ flags
+  uint addrs[NADDRS];   // Data block addresses, or extents
+};
+
+// An extent-mapped inode (I_EXTENT) holds its content in a
+// sequence of runs of contiguous blocks. The first NIEXTENT
+// runs are kept in addrs[], and addrs[EXTBLOCK] is a block
+// holding up to NEXTENT more. A run of length 0 ends the list.
+struct extent {
+  uint start;           // first block of the run
+  uint len;             // number of blocks in the run
 };
 
+// An I_INLINE file's data, at most NINLINE bytes, is kept in
+// addrs[] rather than in a block of its own. A file starts out
+// inline and loses the flag when it grows too big for it.
+#define NINLINE (NADDRS * sizeof(uint))
+
+#define NIEXTENT ((NADDRS-1) * sizeof(uint) / sizeof(struct extent))
+#define EXTBLOCK (NADDRS-1)
+#define NEXTENT (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -58,3 +85,29 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// An indexed directory (I_DIRINDEX) keeps the rest of its first
+// block, after "." and "..", for an index of its other blocks,
+// sorted by hash. Block blk holds the names whose dirhash() is
+// at least hash and less than the next entry's. The first entry
+// has hash 0 and holds the count. Index entries look like free
+// dirents (inum 0) to readers of the directory.
+struct dxentry {
+  ushort inum;          // always 0
+  ushort count;         // number of entries (first entry only)
+  uint hash;            // least hash of the names in blk
+  uint blk;             // directory block number
+  uint unused;
+};
+
+#define DPB (BSIZE / sizeof(struct dirent))
+#define NDXENTRY (DPB - 2)
+
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
@@ -0,0 +1,97 @@
+// Batched system calls.
+//
+// Each system call costs a trip through the trampoline and
+// usertrap(). A process that makes many can instead queue them
+// in an I/O ring, a page it shares with the kernel (ioring.h),
+// and have the kernel make the whole batch in one trap, with
+// ioring_enter().
+//
+// The process advances sqtail and cqhead, the kernel sqhead and
+// cqtail; each side only reads the other's. The kernel copies a
+// submission out of the page before looking at it, since the
+// process may change it at any time.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "syscall.h"
+#include "defs.h"
+#include "ioring.h"
+
+// the system calls a ring may make.
+static int
+ringop(int op)
+{
+  switch(op){
+  case SYS_read:
+  case SYS_write:
+  case SYS_open:
+  case SYS_close:
+  case SYS_fstat:
+  case SYS_pread:
+  case SYS_pwrite:
+    return 1;
+  }
+  return 0;
+}
+
+// Map a zeroed ring page at IORING, if there isn't one,
+// and return its address.
+uint64
+sys_ioring_setup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  if(walkaddr(p->pagetable, IORING) != 0)
+    return IORING;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pagetable, IORING, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return IORING;
+}
+
+// Make the queued system calls, in order, until the
+// submission queue is empty or the completion queue full.
+// Returns how many were made.
+uint64
+sys_ioring_enter(void)
+{
+  struct proc *p = myproc();
+  struct ioring *r;
+  struct iosqe sqe;
+  struct iocqe *cqe;
+  pte_t *pte;
+  uint tail;
+  int n;
+
+  // the kernel writes the ring through its physical address,
+  // so it had better still be the private, writable page
+  // ioring_setup() mapped, not one shared copy-on-write.
+  if((pte = walk(p->pagetable, IORING, 0)) == 0 ||
+     (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W) || (*pte & PTE_EN_W))
+    return -1;
+  r = (struct ioring*)PTE2PA(*pte);
+  tail = r->sqtail;
+  __sync_synchronize();
+  if(tail - r->sqhead > NSQE)
+    return -1;
+
+  for(n = 0; r->sqhead != tail && r->cqtail - r->cqhead < NCQE && !killed(p); n++){
+    sqe = r->sq[r->sqhead % NSQE];
+    cqe = &r->cq[r->cqtail % NCQE];
+    cqe->data = sqe.data;
+    cqe->res = ringop(sqe.op) ? syscallv(sqe.op, sqe.arg) : -1;
+    __sync_synchronize();
+    r->sqhead++;
+    r->cqtail++;
+  }
+  return n;
+}
@@ -0,0 +1,28 @@
+// I/O ring: a page a process shares with the kernel, mapped
+// at IORING by ioring_setup(). See kernel/ioring.c.
+
+#define NSQE 32  // submission slots
+#define NCQE 64  // completion slots
+
+// A system call for the kernel to make.
+struct iosqe {
+  int op;         // SYS_read, SYS_write, SYS_open, SYS_close,
+                  // SYS_fstat, SYS_pread or SYS_pwrite
+  uint64 arg[4];  // its arguments, in order
+  uint64 data;    // handed back in the completion
+};
+
+// The outcome of a submission.
+struct iocqe {
+  uint64 data;    // the submission's data
+  int res;        // what the system call returned
+};
+
+struct ioring {
+  uint sqhead;    // next submission the kernel takes
+  uint sqtail;    // next submission slot the process fills
+  uint cqhead;    // next completion the process takes
+  uint cqtail;    // next completion slot the kernel fills
+  struct iosqe sq[NSQE];
+  struct iocqe cq[NCQE];
+};
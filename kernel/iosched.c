@@ -0,0 +1,159 @@
+// I/O scheduler.
+//
+// Sits between the buffer cache and the virtio disk driver.
+// Blocks used to reach the driver in whatever order their
+// callers issued them; now they are queued per device,
+// kept sorted by block number (a one-way elevator), and
+// dispatched in batches.
+//
+// Interface:
+// * iosched_add(b, write) queues a locked buf for a read or write.
+// * iosched_wait(b) dispatches the queue if b is still in it,
+//     then sleeps until b's transfer has finished.
+//
+// A dispatch takes the whole queue, cuts it into runs of
+// adjacent blocks that go in the same direction, and hands
+// each run to the driver as a single request. The caller
+// must keep b locked from iosched_add() until iosched_wait()
+// returns, so a block is never in a queue twice.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+// longest run of adjacent blocks merged into one request.
+// the driver needs two descriptors more than this.
+#define MAXMERGE 8
+
+struct ioqueue {
+  struct spinlock lock;
+  struct buf *head;  // pending bufs, sorted by blockno, through qnext
+
+  // statistics, protected by lock.
+  uint nbuf;         // bufs queued
+  uint nreq;         // requests handed to the driver
+  uint nmerged;      // bufs that rode along in another buf's request
+  uint nbatch;       // dispatches
+};
+
+static struct ioqueue ioq[NDISK];
+
+void
+iosched_init(void)
+{
+  for(int i = 0; i < NDISK; i++)
+    initlock(&ioq[i].lock, "ioq");
+}
+
+static struct ioqueue*
+getq(uint dev)
+{
+  if(dev >= NDISK)
+    panic("iosched: dev");
+  return &ioq[dev];
+}
+
+// Queue b for a read (write == 0) or a write.
+// Caller must hold b->lock.
+void
+iosched_add(struct buf *b, int write)
+{
+  struct ioqueue *q = getq(b->dev);
+  struct buf **pp;
+
+  acquire(&q->lock);
+  b->qwrite = write;
+  b->queued = 1;
+  b->disk = 1;
+  for(pp = &q->head; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  q->nbuf++;
+  release(&q->lock);
+}
+
+// Send everything queued on q to the driver.
+// Caller holds q->lock; it is released on return.
+static void
+dispatch(struct ioqueue *q)
+{
+  struct buf *b, *run, *list;
+  int n, nreq, nmerged;
+
+  list = q->head;
+  q->head = 0;
+  for(b = list; b; b = b->qnext)
+    b->queued = 0;
+  q->nbatch++;
+  release(&q->lock);
+
+  // cut the sorted list into runs of adjacent blocks, each
+  // chained through qnext, and submit each run as one request.
+  // a run may complete (and its bufs be re-queued) as soon as
+  // it is submitted, so find the next run before submitting.
+  nreq = nmerged = 0;
+  while(list){
+    run = list;
+    b = run;
+    for(n = 1; n < MAXMERGE && b->qnext &&
+          b->qnext->blockno == b->blockno + 1 &&
+          b->qnext->qwrite == run->qwrite; n++)
+      b = b->qnext;
+    list = b->qnext;
+    b->qnext = 0;
+    virtio_disk_submit(run, n, run->qwrite);
+    nreq++;
+    nmerged += n - 1;
+  }
+  virtio_disk_kick();
+
+  acquire(&q->lock);
+  q->nreq += nreq;
+  q->nmerged += nmerged;
+  release(&q->lock);
+}
+
+// Wait for a buf queued by iosched_add() to be transferred,
+// dispatching the queue it is waiting in if need be.
+// Caller must hold b->lock.
+void
+iosched_wait(struct buf *b)
+{
+  struct ioqueue *q = getq(b->dev);
+
+  acquire(&q->lock);
+  if(b->queued)
+    dispatch(q);
+  else
+    release(&q->lock);
+
+  virtio_disk_wait(b);
+}
+
+// Print per-device queue statistics. For debugging.
+void
+iostat(void)
+{
+  struct ioqueue *q;
+  uint nbuf, nreq, nmerged, nbatch;
+
+  for(int i = 0; i < NDISK; i++){
+    q = &ioq[i];
+    acquire(&q->lock);
+    nbuf = q->nbuf;
+    nreq = q->nreq;
+    nmerged = q->nmerged;
+    nbatch = q->nbatch;
+    release(&q->lock);
+    if(nbuf == 0)
+      continue;
+    printf("disk %d: %d bufs, %d requests in %d batches, %d merged (%d%%)\n",
+           i, nbuf, nreq, nbatch, nmerged, nmerged * 100 / nbuf);
+  }
+}
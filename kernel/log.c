@@ -6,135 +6,398 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction is closed when there are no FS system
+// calls active in it. Thus there is never any reasoning
+// required about whether a commit might write an uncommitted
+// system call's updates to disk.
+//
+// Group commit: when the open transaction's last system call
+// ends, the transaction is closed and a copy of its blocks is
+// frozen in log.lbuf[]. From then on new system calls join a
+// fresh open transaction while the frozen copy is written to
+// the log. If the fresh transaction becomes idle while that
+// commit is still in progress, the committer commits it next.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end, telling begin_op() the most blocks it
+// may write. Usually begin_op() just reserves that many log
+// blocks and returns. But if the open transaction is close
+// to running out of log space, it sleeps until that
+// transaction closes.
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+// The log is a physical re-do log containing disk blocks,
+// used as a circular journal. The on-disk log format:
+//   header block, containing the first slot in use (the tail)
+//     and the sequence number of the transaction there
+//   slot 0
+//   slot 1
 //   ...
-// Log appends are synchronous.
+// Each transaction takes a descriptor slot followed by a slot
+// for each of its blocks. The descriptor holds the transaction's
+// sequence number, the block # and checksum of each block,
+// and a checksum of itself. The descriptor and the blocks are
+// written together, and the transaction commits once they all
+// are on disk; end_op() returns then. Recovery replays the
+// transactions from the tail for as long as their sequence
+// numbers follow on and their checksums match, so a torn or
+// stale transaction ends the log without an erase write.
+//
+// Installing the blocks to their home locations is left to the
+// checkpointer, a kernel thread that runs when the ring is half
+// full or a commit is short of slots. It writes the header only
+// to move the tail, and slots are reused only after that.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// Contents of the header block.
 struct logheader {
+  uint tail;
+  uint seq;
+};
+
+// Contents of a descriptor slot.
+#define LOGMAGIC 0x10c0ffee
+#define LOGTRANS ((BSIZE/sizeof(uint) - 4) / 2)  // max blocks per transaction
+struct logdesc {
+  uint magic;
+  uint seq;
+  uint n;
+  uint sum;              // of the descriptor, computed with sum = 0
+  uint block[LOGTRANS];  // home block #
+  uint bsum[LOGTRANS];   // checksum of the logged block
+};
+
+// A transaction: the block #s it has logged so far, and an
+// open-addressed hash table from block # to index in block[],
+// so that log_write() finds absorbed blocks without a scan.
+#define NLOGHASH (LOGSIZE*4)
+struct trans {
   int n;
   int block[LOGSIZE];
+  short hash[NLOGHASH]; // index+1 in block[], or 0 if empty
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nslot;       // slots in the ring (size - 1)
+  int maxtrans;    // max blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // a transaction is being committed.
+  int freezing;    // closing a transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct trans lh; // the open transaction
+
+  // the ring. positions count the slots ever handed out and
+  // never wrap; position p lives in slot p % nslot.
+  // dtail <= tail <= committed <= head.
+  uint64 dtail;     // tail as recorded on disk
+  uint64 tail;      // first position not yet installed
+  uint64 committed; // end of the committed positions
+  uint64 head;      // next position to hand out
+  uint tailseq;     // sequence # of the transaction at tail
+  uint cseq;        // sequence # of the transaction at committed
+  uint seq;         // next sequence # to hand out
+  int ckpt;         // a commit is waiting for slots.
+
+  int block[LOGSIZE];          // home block # of each slot, 0 for a descriptor
+  struct buf *pinned[LOGSIZE]; // cache buf of each slot, pinned until installed
+  struct buf lbuf[LOGSIZE];    // frozen copy of each slot's block
 };
 struct log log;
 
 static void recover_from_log(void);
+static void checkpoint(void);
 static void commit();
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  if (sizeof(struct logdesc) > BSIZE)
+    panic("initlog: too big logdesc");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.nslot = log.size - 1;
+  if (log.nslot <= MAXOPBLOCKS || log.nslot > LOGSIZE)
+    panic("initlog: log size");
+  log.maxtrans = log.nslot - 1;
+  if (log.maxtrans > LOGTRANS)
+    log.maxtrans = LOGTRANS;
   log.dev = dev;
+  for (int i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&log.lbuf[i].lock, "logbuf");
+    log.lbuf[i].dev = dev;
+  }
   recover_from_log();
+  kthread("logckpt", checkpoint);
+}
+
+// Checksum of a block.
+static uint
+cksum(void *data)
+{
+  uint *w = data;
+  uint h = 2166136261U;
+
+  for (int i = 0; i < BSIZE/4; i++)
+    h = (h ^ w[i]) * 16777619U;
+  return h;
 }
 
-// Copy committed blocks from log to their home location
+// Checksum of a descriptor, leaving out its sum field.
+static uint
+desc_cksum(struct logdesc *d)
+{
+  uint sum, h;
+
+  sum = d->sum;
+  d->sum = 0;
+  h = cksum(d);
+  d->sum = sum;
+  return h;
+}
+
+// Close the open transaction into the ring at position base,
+// as transaction seq: copy its blocks out of the cache, so that
+// the next open transaction may go on modifying them, and
+// fill in its descriptor.
+// No FS system call is running while this happens.
 static void
-install_trans(int recovering)
+freeze(uint64 base, uint seq)
 {
-  int tail;
+  int i, slot;
+  struct logdesc *d;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  slot = base % log.nslot;
+  d = (struct logdesc *) log.lbuf[slot].data;
+  memset(d, 0, BSIZE);
+  d->magic = LOGMAGIC;
+  d->seq = seq;
+  d->n = log.lh.n;
+  log.block[slot] = 0;
+  log.pinned[slot] = 0;
+
+  for (i = 0; i < log.lh.n; i++) {
+    slot = (base + 1 + i) % log.nslot;
+    struct buf *b = bread(log.dev, log.lh.block[i]); // pinned; no I/O
+    memmove(log.lbuf[slot].data, b->data, BSIZE);
+    log.block[slot] = log.lh.block[i];
+    log.pinned[slot] = b;
+    brelse(b);
+    d->block[i] = log.lh.block[i];
+    d->bsum[i] = cksum(log.lbuf[slot].data);
   }
+  d->sum = desc_cksum(d);
+}
+
+// Is the block at position p logged again before position end?
+static int
+superseded(uint64 p, uint64 end)
+{
+  uint64 q;
+
+  for (q = p + 1; q < end; q++)
+    if (log.block[q % log.nslot] == log.block[p % log.nslot])
+      return 1;
+  return 0;
 }
 
-// Read the log header from disk into the in-memory log header
+// Should write_slots() leave out position p?
+static int
+skip(uint64 p, uint64 end, int home)
+{
+  return home && (log.block[p % log.nslot] == 0 || superseded(p, end));
+}
+
+// Write the frozen blocks at positions from..from+n-1 to disk,
+// either to their log slots or (if home is set) to their home
+// locations. Descriptors are not installed, and a block logged
+// more than once is installed only from its newest copy, since
+// the disk may reorder the writes.
+// All the writes are queued before any is waited for, so the
+// I/O scheduler can sort and merge them.
 static void
-read_head(void)
+write_slots(uint64 from, int n, int home)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  uint64 p;
+  int slot;
+
+  for (p = from; p < from + n; p++) {
+    if (skip(p, from + n, home))
+      continue;
+    slot = p % log.nslot;
+    struct buf *b = &log.lbuf[slot];
+    acquiresleep(&b->lock);
+    b->blockno = home ? log.block[slot] : log.start+slot+1;
+    bqueue(b);
+  }
+  for (p = from; p < from + n; p++) {
+    if (skip(p, from + n, home))
+      continue;
+    struct buf *b = &log.lbuf[p % log.nslot];
+    bwait(b);
+    releasesleep(&b->lock);
   }
+}
+
+// Read the log header from disk.
+static void
+read_head(struct logheader *h)
+{
+  struct buf *buf = bread(log.dev, log.start);
+  memmove(h, buf->data, sizeof(*h));
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the in-memory tail to the header on disk,
+// after which the slots before it may be reused.
+// Only the checkpointer, or recovery, calls this.
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct buf *buf;
+  struct logheader *hb;
+  uint64 tail;
+
+  buf = bread(log.dev, log.start);
+  hb = (struct logheader *) (buf->data);
+  acquire(&log.lock);
+  tail = log.tail;
+  hb->tail = tail % log.nslot;
+  hb->seq = log.tailseq;
+  release(&log.lock);
   bwrite(buf);
   brelse(buf);
+
+  acquire(&log.lock);
+  log.dtail = tail;
+  wakeup(&log.dtail);
+  release(&log.lock);
+}
+
+// Is d, read from slot, the descriptor of transaction seq,
+// whole and within the space slots left to scan?
+static int
+valid_trans(struct logdesc *d, uint seq, int slot, int space)
+{
+  int i;
+  uint sum;
+
+  if (d->magic != LOGMAGIC || d->seq != seq ||
+      d->n > log.maxtrans || d->n + 1 > space)
+    return 0;
+  if (desc_cksum(d) != d->sum)
+    return 0;
+  for (i = 0; i < d->n; i++) {
+    struct buf *lbuf = bread(log.dev, log.start+(slot+1+i)%log.nslot+1);
+    sum = cksum(lbuf->data);
+    brelse(lbuf);
+    if (sum != d->bsum[i])
+      return 0;
+  }
+  return 1;
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logheader h;
+  struct logdesc *d;
+  int i, slot, used;
+
+  read_head(&h);
+  slot = h.tail % log.nslot;
+  // copy committed transactions from log to disk, oldest first
+  for (used = 0; used < log.nslot; ) {
+    struct buf *dbuf = bread(log.dev, log.start+slot+1); // read descriptor
+    d = (struct logdesc *) dbuf->data;
+    if (!valid_trans(d, h.seq, slot, log.nslot - used)) {
+      brelse(dbuf);
+      break;
+    }
+    for (i = 0; i < d->n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+(slot+1+i)%log.nslot+1); // read log block
+      struct buf *hbuf = bread(log.dev, d->block[i]); // read dst
+      memmove(hbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(hbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(hbuf);
+    }
+    used += d->n + 1;
+    slot = (slot + d->n + 1) % log.nslot;
+    h.seq++;
+    brelse(dbuf);
+  }
+
+  // start the ring after the last committed transaction.
+  log.dtail = log.tail = log.committed = log.head = slot;
+  log.tailseq = log.cseq = log.seq = h.seq;
+  write_head();
+}
+
+// The checkpointer's body. Install committed blocks to their
+// home locations, oldest first, and then free their slots.
+static void
+checkpoint(void)
+{
+  uint64 p, tail;
+  uint seq;
+  int n;
+
+  acquire(&log.lock);
+  for (;;) {
+    if (log.committed == log.tail ||
+       (!log.ckpt && log.committed - log.tail < log.nslot/2)) {
+      sleep(&log.ckpt, &log.lock);
+      continue;
+    }
+    log.ckpt = 0;
+    tail = log.tail;
+    n = log.committed - tail;
+    seq = log.cseq;
+    release(&log.lock);
+
+    write_slots(tail, n, 1); // Install writes to home locations
+    for (p = tail; p < tail + n; p++)
+      if (log.pinned[p % log.nslot])
+        bunpin(log.pinned[p % log.nslot]);
+    acquire(&log.lock);
+    log.tail = tail + n;
+    log.tailseq = seq;
+    release(&log.lock);
+    write_head();            // Move the tail past them on disk
+
+    acquire(&log.lock);
+  }
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call,
+// which will write at most nblocks blocks.
 void
-begin_op(void)
+begin_op(int nblocks)
 {
+  struct proc *p = myproc();
+
+  if(nblocks < 1 || nblocks > log.maxtrans)
+    panic("begin_op");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > log.maxtrans){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
+      p->logblocks = nblocks;
       release(&log.lock);
       break;
     }
@@ -142,23 +405,24 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and no other commit is in progress.
 void
 end_op(void)
 {
+  struct proc *p = myproc();
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= p->logblocks;
+  p->logblocks = 0;
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // and this op's blocks are no longer reserved.
     wakeup(&log);
   }
   release(&log.lock);
@@ -167,44 +431,69 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Commit the open transaction, and then any transaction
+// that went idle while this one was being written.
+// Called with log.committing set and log.outstanding zero.
 static void
-write_log(void)
+commit()
 {
-  int tail;
+  uint64 base;
+  uint seq;
+  int n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  acquire(&log.lock);
+  while(log.outstanding == 0 && log.lh.n > 0){
+    if(log.head - log.dtail + log.lh.n + 1 > log.nslot){
+      // not enough free slots; have the checkpointer
+      // make room. system calls may join meanwhile.
+      log.ckpt = 1;
+      wakeup(&log.ckpt);
+      sleep(&log.dtail, &log.lock);
+      continue;
+    }
+    // close the open transaction into the slots at the head
+    // of the ring; later system calls join a new one.
+    base = log.head;
+    n = log.lh.n;
+    seq = log.seq++;
+    log.head += n + 1;
+    log.freezing = 1;
+    release(&log.lock);
+    freeze(base, seq);
+    acquire(&log.lock);
+    log.lh.n = 0;
+    memset(log.lh.hash, 0, sizeof(log.lh.hash));
+    log.freezing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_slots(base, n + 1, 0); // Write descriptor and blocks -- the real commit
+
+    acquire(&log.lock);
+    log.committed = base + n + 1;
+    log.cseq = seq + 1;
+    if(log.committed - log.tail >= log.nslot/2)
+      wakeup(&log.ckpt);
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
-static void
-commit()
+// The most blocks an op can ask begin_op() for:
+// a whole transaction's worth.
+int
+log_maxop(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
-  }
+  return log.maxtrans;
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit() and the checkpointer will do the disk writes.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,23 +503,24 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  int i, h;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE || log.lh.n >= log.maxtrans)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  h = (b->blockno * 2654435761U) % NLOGHASH;
+  while ((i = log.lh.hash[h]) != 0) {
+    if (log.lh.block[i-1] == b->blockno)   // log absorption
       break;
+    h = (h + 1) % NLOGHASH;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  if (i == 0) {  // Add new block to log
     bpin(b);
-    log.lh.n++;
+    log.lh.block[log.lh.n++] = b->blockno;
+    log.lh.hash[h] = log.lh.n;
   }
   release(&log.lock);
 }
-
@@ -62,6 +62,25 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   UKDATA (read-only, the same page in every process)
+//   USYSCALL (read-only, p->usyscall)
+//   IORING (shared with the kernel, if ioring_setup() was called)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define IORING (TRAPFRAME - PGSIZE)
+#define USYSCALL (IORING - PGSIZE)
+#define UKDATA (USYSCALL - PGSIZE)
+
+#ifndef __ASSEMBLER__
+// Kernel data that user programs can read without a system
+// call: per-process at USYSCALL, and system-wide at UKDATA.
+struct usyscall {
+  int pid;            // Process ID
+};
+
+struct ukdata {
+  uint ticks;         // timer interrupts since boot
+  uint64 tickcycles;  // time CSR counts from one to the next
+};
+#endif
@@ -2,12 +2,21 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // active i-nodes to start with; more are added as needed
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes
+#define DIROPBLOCKS  12  // max # of blocks a directory op writes, not counting putblocks()
+#define LOGSIZE     128  // max data blocks in on-disk log
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*2)  // size of disk block cache
+#define NDISK         2  // maximum disk device number + 1
+#define DISKPOLL      2  // poll the disk while <= this many bufs in flight
+#define NIOV         16  // max buffers in a readv() or writev()
+#define PIPEPAGES    16  // max pages in a pipe's buffer
+#define TICKCYCLES 1000000  // time CSR counts between timer interrupts
 #define FSSIZE       2000  // size of file system in blocks
+#ifndef EXTENTFILES
+#define EXTENTFILES     1  // map new files' blocks by extents, not indirect blocks
+#endif
 #define MAXPATH      128   // maximum file path name
@@ -7,16 +7,46 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+#define NPSEG 16  // page segments a pipe can hold
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// A pipe's buffer is a ring of whole pages, one to begin with.
+// fcntl(F_SETPIPE_SZ) can resize it to a power-of-two number of
+// pages, up to PIPEPAGES, so that the ring's size divides 2^32
+// and positions stay in step when nread and nwrite wrap.
+//
+// splice() moves data between the ring and a file with the
+// lock released, since readi() and writei() sleep. While it
+// does, wbusy (or rbusy) keeps other writers (or readers) and
+// resizes away from the ring.
+//
+// vmsplice() hands whole pages of the writer's memory to the
+// pipe by reference instead of copying them into the ring. A
+// page segment sits in the stream just before the ring byte
+// at its pos, and piperead() maps it copy-on-write into the
+// reader's memory if it can, or copies it if not.
+struct pseg {
+  char *pa;       // the page, with a reference held by the pipe
+  uint pos;       // ring position it comes before
+  uint off;       // bytes of it already read
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];  // the ring, size/PGSIZE pages of it
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int wbusy;      // a splice is writing into the ring
+  int rbusy;      // a splice is reading from the ring
+  struct pseg seg[NPSEG];  // queued page segments
+  uint nsegw;     // number of segments queued
+  uint nsegr;     // number of segments read
 };
 
 int
@@ -30,10 +60,18 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi->page, 0, sizeof(pi->page));
+  if((pi->page[0] = kalloc()) == 0)
+    goto bad;
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->wbusy = 0;
+  pi->rbusy = 0;
+  pi->nsegw = 0;
+  pi->nsegr = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -46,8 +84,11 @@ pipealloc(struct file **f0, struct file **f1)
   return 0;
 
  bad:
-  if(pi)
+  if(pi){
+    if(pi->page[0])
+      kfree(pi->page[0]);
     kfree((char*)pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +109,96 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    for(int i = 0; i < PIPEPAGES; i++)
+      if(pi->page[i])
+        kfree(pi->page[i]);
+    for(; pi->nsegr != pi->nsegw; pi->nsegr++)
+      kfree(pi->seg[pi->nsegr % NPSEG].pa);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
-int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+// The byte of the ring at position pos.
+static char*
+ringp(struct pipe *pi, uint pos)
+{
+  pos %= pi->size;
+  return pi->page[pos / PGSIZE] + pos % PGSIZE;
+}
+
+static int
+pipeempty(struct pipe *pi)
+{
+  return pi->nread == pi->nwrite && pi->nsegr == pi->nsegw;
+}
+
+// The page segment a reader gets next, if it's
+// due before any more of the ring.
+static struct pseg*
+nextseg(struct pipe *pi)
+{
+  struct pseg *sg = &pi->seg[pi->nsegr % NPSEG];
+
+  if(pi->nsegr != pi->nsegw && sg->pos == pi->nread)
+    return sg;
+  return 0;
+}
+
+// Where the next bytes a reader gets are: *m of them, in
+// a page segment or in one page of the ring.
+static char*
+rnext(struct pipe *pi, uint *m)
+{
+  struct pseg *sg;
+  uint end = pi->nwrite;
+
+  if((sg = nextseg(pi)) != 0){
+    *m = PGSIZE - sg->off;
+    return sg->pa + sg->off;
+  }
+  if(pi->nsegr != pi->nsegw)
+    end = pi->seg[pi->nsegr % NPSEG].pos;
+  *m = min(end - pi->nread, PGSIZE - pi->nread % PGSIZE);
+  return ringp(pi, pi->nread);
+}
+
+// The reader has taken m bytes from where rnext() said.
+static void
+radvance(struct pipe *pi, uint m)
+{
+  struct pseg *sg;
+
+  if((sg = nextseg(pi)) != 0){
+    if((sg->off += m) == PGSIZE){
+      kfree(sg->pa);
+      pi->nsegr++;
+    }
+  } else {
+    pi->nread += m;
+  }
+}
+
+// Data moves between user memory and the pipe in chunks that
+// stop where a page of the ring ends and where the user page
+// ends, so that one copyin() or copyout() moves each chunk,
+// and a bad address costs only the bytes on its own page.
+static uint
+chunk(uint64 addr, uint n, uint avail)
+{
+  n = min(n, avail);
+  return min(n, PGSIZE - addr % PGSIZE);
+}
+
+// Write n bytes at user address addr into the pipe. If vm
+// is set, whole pages go in as page segments.
+static int
+pipeput(struct pipe *pi, uint64 addr, int n, int vm)
 {
   int i = 0;
+  uint m;
+  uint64 pa;
+  struct pseg *sg;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +207,24 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(vm && !pi->wbusy && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       pi->nsegw - pi->nsegr < NPSEG &&
+       (pa = uvmshare(pr->pagetable, pr->sz, addr + i)) != 0){
+      sg = &pi->seg[pi->nsegw++ % NPSEG];
+      sg->pa = (char*)pa;
+      sg->pos = pi->nwrite;
+      sg->off = 0;
+      i += PGSIZE;
+    } else if(pi->wbusy || pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = min(pi->nread + pi->size - pi->nwrite, PGSIZE - pi->nwrite % PGSIZE);
+      m = chunk(addr + i, n - i, m);
+      if(copyin(pr->pagetable, ringp(pi, pi->nwrite), addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -103,28 +234,244 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 }
 
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, addr, n, 0);
+}
+
+int
+pipevmsplice(struct pipe *pi, uint64 addr, int n)
+{
+  return pipeput(pi, addr, n, 1);
+}
+
+// Copy up to n bytes of what is in the ring to user
+// address addr. Returns how many were copied.
+// Caller holds pi->lock.
+static int
+ringcopy(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint m;
+  char *src;
+  struct proc *pr = myproc();
+
+  for(i = 0; i < n && !pipeempty(pi); i += m){  //DOC: piperead-copy
+    src = rnext(pi, &m);
+    // a whole page segment, read into a whole page:
+    // map it there instead of copying it.
+    if(nextseg(pi) && m == PGSIZE && n - i >= PGSIZE &&
+       (addr + i) % PGSIZE == 0 && uvmremap(pr->pagetable, pr->sz, addr + i, (uint64)src) == 0){
+      radvance(pi, m);
+      continue;
+    }
+    m = chunk(addr + i, n - i, m);
+    if(copyout(pr->pagetable, addr + i, src, m) == -1)
+      break;
+    radvance(pi, m);
+  }
+  return i;
+}
+
+// Read from pi into the cnt buffers in iov: wait until the
+// pipe has something in it, then take what is there, filling
+// one buffer after another, without waiting again.
+int
+pipereadv(struct pipe *pi, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pipeempty(pi) && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  tot = 0;
+  for(i = 0; i < cnt && !pipeempty(pi); i++){
+    r = ringcopy(pi, (uint64)iov[i].iov_base, iov[i].iov_len);
+    tot += r;
+    if(r < iov[i].iov_len)
       break;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
-  return i;
+  return tot;
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n)
+{
+  struct iovec iov = { (void*)addr, n };
+
+  return pipereadv(pi, &iov, 1);
+}
+
+// A splice is done with the ring; let whoever
+// is waiting for it have another look.
+static void
+unbusy(struct pipe *pi, int *busy)
+{
+  *busy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+}
+
+// Move up to n bytes from i-node file f into the ring,
+// straight out of the buffer cache.
+int
+pipefill(struct pipe *pi, struct file *f, int n)
+{
+  int tot = 0, r = 0;
+  uint pos, m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(tot < n){
+    if(pi->readopen == 0 || killed(pr)){
+      r = -1;
+      break;
+    }
+    if(pi->wbusy || pi->nwrite == pi->nread + pi->size){
+      wakeup(&pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+    pos = pi->nwrite;
+    m = min(n - tot, pi->nread + pi->size - pos);
+    m = min(m, PGSIZE - pos % PGSIZE);
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    ilock(f->ip);
+    if((r = readi(f->ip, 0, (uint64)ringp(pi, pos), f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+
+    acquire(&pi->lock);
+    unbusy(pi, &pi->wbusy);
+    if(r <= 0)
+      break;
+    pi->nwrite += r;
+    tot += r;
+  }
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return r < 0 ? -1 : tot;
+}
+
+// Move up to n bytes from the ring into i-node file f,
+// straight into the buffer cache. Like piperead(), wait
+// only if the pipe is empty to begin with.
+int
+pipedrain(struct pipe *pi, struct file *f, int n)
+{
+  int tot = 0, r = 0;
+  uint m;
+  char *src;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(tot < n){
+    if(killed(pr)){
+      r = -1;
+      break;
+    }
+    if(pi->rbusy || (pipeempty(pi) && pi->writeopen && tot == 0)){
+      sleep(&pi->nread, &pi->lock);
+      continue;
+    }
+    if(pipeempty(pi))
+      break;
+    src = rnext(pi, &m);
+    m = min(m, n - tot);
+    pi->rbusy = 1;
+    release(&pi->lock);
+
+    begin_op(writeblocks(m));
+    ilock(f->ip);
+    if((r = writei(f->ip, 0, (uint64)src, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op();
+
+    acquire(&pi->lock);
+    unbusy(pi, &pi->rbusy);
+    if(r > 0){
+      radvance(pi, r);
+      tot += r;
+    }
+    if(r != m){
+      r = -1;
+      break;
+    }
+  }
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+  return r < 0 ? -1 : tot;
+}
+
+// Resize pi's ring to hold at least n bytes. Returns the
+// new size, or -1 if n is too big or the ring holds more
+// than would fit.
+static int
+piperesize(struct pipe *pi, int n)
+{
+  char *page[PIPEPAGES], *old;
+  uint size, pos, m;
+  int i, npage, r = -1;
+
+  if(n <= 0 || n > PIPEPAGES*PGSIZE)
+    return -1;
+  for(npage = 1; npage*PGSIZE < n; npage *= 2)
+    ;
+  size = npage*PGSIZE;
+  memset(page, 0, sizeof(page));
+  for(i = 0; i < npage; i++){
+    if((page[i] = kalloc()) == 0)
+      goto bad;
+  }
+
+  acquire(&pi->lock);
+  while(pi->wbusy || pi->rbusy)
+    sleep(&pi->nwrite, &pi->lock);
+  if(pi->nwrite - pi->nread > size){
+    release(&pi->lock);
+    goto bad;
+  }
+  // what's buffered keeps its positions in the new ring.
+  for(pos = pi->nread; pos != pi->nwrite; pos += m){
+    m = min(pi->nwrite - pos, PGSIZE - pos % PGSIZE);
+    memmove(page[pos % size / PGSIZE] + pos % PGSIZE, ringp(pi, pos), m);
+  }
+  for(i = 0; i < PIPEPAGES; i++){
+    old = pi->page[i];
+    pi->page[i] = page[i];
+    page[i] = old;
+  }
+  pi->size = size;
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+  r = size;
+
+ bad:
+  for(i = 0; i < PIPEPAGES; i++)
+    if(page[i])
+      kfree(page[i]);
+  return r;
+}
+
+int
+pipefcntl(struct pipe *pi, int cmd, int arg)
+{
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pi->size;
+  case F_SETPIPE_SZ:
+    return piperesize(pi, arg);
+  }
+  return -1;
 }
@@ -16,6 +16,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -132,6 +133,15 @@ found:
     return 0;
   }
 
+  // Allocate a page for user programs to read p's pid from.
+  if((p->usyscall = (struct usyscall *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  memset(p->usyscall, 0, PGSIZE);
+  p->usyscall->pid = p->pid;
+
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
@@ -158,6 +168,9 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -202,6 +215,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the pages of kernel data user programs can read:
+  // p's own, and the one all processes share.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  if(mappages(pagetable, UKDATA, PGSIZE,
+              (uint64)ukdata, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, USYSCALL, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -212,6 +243,10 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmunmap(pagetable, UKDATA, 1, 0);
+  if(walkaddr(pagetable, IORING))
+    uvmunmap(pagetable, IORING, 1, 1);
   uvmfree(pagetable, sz);
 }
 
@@ -254,6 +289,23 @@ userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel thread that runs fn(), which must not return.
+// A kernel thread is a process that never goes to user space:
+// it has no user memory, open files or current directory.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -264,6 +316,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    // keep clear of the pages mapped at the top of user memory.
+    if(sz + n > UKDATA)
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
@@ -365,7 +420,7 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_op(putblocks());
   iput(p->cwd);
   end_op();
   p->cwd = 0;
@@ -535,6 +590,20 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -100,8 +100,11 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // data page user programs read (see memlayout.h)
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  void (*kfn)(void);           // Body of a kernel thread (see kthread())
+  int logblocks;               // Log blocks reserved by begin_op()
   char name[16];               // Process name (debugging)
 };
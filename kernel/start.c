@@ -66,7 +66,7 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = TICKCYCLES; // cycles; about 1/10th second in qemu.
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
@@ -84,6 +84,10 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
+  // let user programs read the time CSR.
+  w_mcounteren(r_mcounteren() | COUNTEREN_TM);
+  w_scounteren(r_scounteren() | COUNTEREN_TM);
+
   // enable machine-mode timer interrupts.
   w_mie(r_mie() | MIE_MTIE);
 }
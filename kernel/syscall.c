@@ -101,6 +101,15 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_ioring_setup(void);
+extern uint64 sys_ioring_enter(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +135,15 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_fcntl]   sys_fcntl,
+[SYS_splice]  sys_splice,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_ioring_setup] sys_ioring_setup,
+[SYS_ioring_enter] sys_ioring_enter,
 };
 
 void
@@ -145,3 +163,25 @@ syscall(void)
     p->trapframe->a0 = -1;
   }
 }
+
+// Make system call num with arguments args, as if the process
+// had trapped with them in its argument registers, and return
+// its result. For ioring_enter(), which lends them its own.
+uint64
+syscallv(int num, uint64 *args)
+{
+  struct trapframe *tf = myproc()->trapframe;
+  uint64 a0 = tf->a0, a1 = tf->a1, a2 = tf->a2, a3 = tf->a3;
+  uint64 r;
+
+  tf->a0 = args[0];
+  tf->a1 = args[1];
+  tf->a2 = args[2];
+  tf->a3 = args[3];
+  r = syscalls[num]();
+  tf->a0 = a0;
+  tf->a1 = a1;
+  tf->a2 = a2;
+  tf->a3 = a3;
+  return r;
+}
@@ -20,3 +20,12 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_fcntl  22
+#define SYS_splice 23
+#define SYS_vmsplice 24
+#define SYS_pread  25
+#define SYS_pwrite 26
+#define SYS_readv  27
+#define SYS_writev 28
+#define SYS_ioring_setup 29
+#define SYS_ioring_enter 30
@@ -107,6 +107,118 @@ sys_close(void)
   return 0;
 }
 
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filefcntl(f, cmd, arg);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filevmsplice(f, p, n);
+}
+
+// Fetch the iovec array for readv() or writev().
+static int
+argiov(struct iovec *iov, int *cnt)
+{
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, cnt);
+  if(*cnt < 0 || *cnt > NIOV)
+    return -1;
+  return copyin(myproc()->pagetable, (char*)iov, p, *cnt * sizeof(struct iovec));
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, (uint*)&off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, (uint*)&off);
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, 0);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, 0);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -129,7 +241,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(DIROPBLOCKS + putblocks());
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -196,7 +308,7 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(DIROPBLOCKS + putblocks());
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -222,6 +334,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp->dev, dp->inum, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -314,7 +427,7 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  begin_op(DIROPBLOCKS + putblocks());
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -376,7 +489,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_op(DIROPBLOCKS + putblocks());
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -393,7 +506,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_op(DIROPBLOCKS + putblocks());
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
@@ -413,7 +526,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_op(putblocks());
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
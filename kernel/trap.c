@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+struct ukdata *ukdata;  // mapped read-only at UKDATA in every process
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +21,10 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((ukdata = (struct ukdata*)kalloc()) == 0)
+    panic("trapinit");
+  memset(ukdata, 0, PGSIZE);
+  ukdata->tickcycles = TICKCYCLES;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -186,6 +191,7 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
+  ukdata->ticks = ticks;
   wakeup(&ticks);
   release(&tickslock);
 }
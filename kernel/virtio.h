@@ -47,7 +47,7 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+#define NUM 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -61,11 +61,12 @@ struct virtq_desc {
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_AVAIL_F_NO_INTERRUPT, or zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // with EVENT_IDX: interrupt once used idx passes this
 };
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // without EVENT_IDX: don't interrupt
 
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
@@ -78,6 +79,7 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // with EVENT_IDX: notify once avail idx passes this
 };
 
 // these are specific to virtio block devices, e.g. disks,
@@ -19,6 +19,10 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// how long virtio_disk_wait() spins on the used ring
+// before going to sleep.
+#define POLLSPIN 100000
+
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
@@ -41,6 +45,9 @@ static struct disk {
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
   uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 kick_idx; // avail->idx when we last notified the device.
+  int event_idx;   // negotiated VIRTIO_RING_F_EVENT_IDX?
+  int inflight;    // bufs submitted but not yet completed.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
@@ -90,9 +97,12 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  // with EVENT_IDX, the used_event and avail_event fields tell
+  // the device when to interrupt and the driver when to notify,
+  // which lets both sides coalesce.
+  disk.event_idx = (features & (1 << VIRTIO_RING_F_EVENT_IDX)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -152,6 +162,46 @@ virtio_disk_init(void)
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
+static void drain(void);
+
+// tell the device there are new avail ring entries.
+static void
+notify(void)
+{
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  disk.kick_idx = disk.avail->idx;
+}
+
+// from the spec: has idx moved past event, going from old to new?
+static int
+need_event(uint16 event, uint16 new, uint16 old)
+{
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
+
+// ask for an interrupt, but only once everything submitted
+// so far has completed, rather than once per request.
+static void
+arm(void)
+{
+  if(disk.event_idx)
+    disk.avail->used_event = disk.avail->idx - 1;
+  else
+    disk.avail->flags = 0;
+  __sync_synchronize();
+}
+
+// ask the device not to interrupt; someone is polling.
+static void
+suppress(void)
+{
+  if(disk.event_idx)
+    disk.avail->used_event = disk.used_idx - 1;
+  else
+    disk.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+  __sync_synchronize();
+}
+
 // find a free descriptor, mark it non-free, return its index.
 static int
 alloc_desc()
@@ -196,12 +246,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,27 +261,48 @@ alloc3_desc(int *idx)
   return 0;
 }
 
+// Queue a request for the run of n bufs starting at b,
+// chained through b->qnext and covering consecutive blocks.
+// Does not tell the device; see virtio_disk_kick().
+// iosched.c has already set b->disk for each buf in the run.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_submit(struct buf *b, int n, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
+  struct buf *bp;
+  int i;
+
+  if(n < 1 || n > NUM - 2)
+    panic("virtio_disk_submit");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. the data may be
+  // scattered over several descriptors, one per buf in the run.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the n+2 descriptors.
+  int idx[NUM];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(allocn_desc(idx, n+2) == 0) {
       break;
     }
+    // let the device get on with what is already queued, and
+    // ask for the interrupt that will have drain() free its
+    // descriptors: interrupts may be suppressed, or armed only
+    // for an earlier batch. anything that finished before
+    // arm() raises no interrupt, so drain() now as well.
+    arm();
+    notify();
+    disk.kick_idx = disk.avail->idx;
+    drain();
+    if(allocn_desc(idx, n+2) == 0)
+      break;
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -249,24 +319,26 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1, bp = b; i <= n; i++, bp = bp->qnext){
+    disk.desc[idx[i]].addr = (uint64) bp->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads bp->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes bp->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
+  // record the run for virtio_disk_intr().
   disk.info[idx[0]].b = b;
+  disk.inflight += n;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -276,34 +348,63 @@ virtio_disk_rw(struct buf *b, int write)
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
 
+  release(&disk.vdisk_lock);
+}
+
+// Tell the device to look at the requests queued by
+// virtio_disk_submit().
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  arm();
   __sync_synchronize();
+  if(!disk.event_idx ||
+     need_event(disk.used->avail_event, disk.avail->idx, disk.kick_idx))
+    notify();
+  disk.kick_idx = disk.avail->idx;
+  release(&disk.vdisk_lock);
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// Wait for b's request to finish.
+// If only a few bufs are in flight, b's request is probably
+// short, and spinning on the used ring for a while returns
+// sooner than sleeping until the completion interrupt, and
+// saves the interrupt.
+void
+virtio_disk_wait(struct buf *b)
+{
+  int spin;
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  acquire(&disk.vdisk_lock);
+  if(DISKPOLL && b->disk == 1 && disk.inflight <= DISKPOLL){
+    suppress();
+    spin = 0;
+    while(b->disk == 1 && spin < POLLSPIN){
+      release(&disk.vdisk_lock);
+      while(*(volatile int*)&b->disk == 1 &&
+            *(volatile uint16*)&disk.used->idx == disk.used_idx &&
+            ++spin < POLLSPIN)
+        ;
+      acquire(&disk.vdisk_lock);
+      drain();
+    }
+    // whoever waits next may rely on the interrupt.
+    arm();
+    drain();
+  }
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
-void
-virtio_disk_intr()
+// Look at the requests the device has finished with,
+// and wake up their bufs' owners.
+// Caller holds disk.vdisk_lock.
+static void
+drain(void)
 {
-  acquire(&disk.vdisk_lock);
-
-  // the device won't raise another interrupt until we tell it
-  // we've seen this interrupt, which the following line does.
-  // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
-  // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
-
   __sync_synchronize();
 
   // the device increments disk.used->idx when it
@@ -314,14 +415,40 @@ virtio_disk_intr()
     int id = disk.used->ring[disk.used_idx % NUM].id;
 
     if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
+      panic("virtio_disk drain status");
 
+    // the disk is done with every buf in the run. a buf's
+    // owner may re-queue it once b->disk is clear, so read
+    // qnext first.
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    while(b){
+      struct buf *nb = b->qnext;
+      b->disk = 0;
+      disk.inflight--;
+      wakeup(b);
+      b = nb;
+    }
+    disk.info[id].b = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
+}
+
+void
+virtio_disk_intr()
+{
+  acquire(&disk.vdisk_lock);
+
+  // the device won't raise another interrupt until we tell it
+  // we've seen this interrupt, which the following line does.
+  // this may race with the device writing new entries to
+  // the "used" ring, in which case we may process the new
+  // completion entries in this interrupt, and have nothing to do
+  // in the next interrupt, which is harmless.
+  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+
+  drain();
 
   release(&disk.vdisk_lock);
 }
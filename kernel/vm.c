@@ -348,6 +348,55 @@ int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
   return 0;
 }
 
+// Share the user page at va with a pipe (see vmsplice()):
+// make it copy-on-write, as fork does, and return its physical
+// address with a reference taken for the pipe, or 0.
+// Only pages of the process's memory below sz qualify, not
+// the pages mapped above it (IORING, USYSCALL, UKDATA, ...).
+uint64
+uvmshare(pagetable_t pagetable, uint64 sz, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va % PGSIZE != 0 || va >= sz || sz - va < PGSIZE)
+    return 0;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_R) == 0)
+    return 0;
+  pa = PTE2PA(*pte);
+  if(kinc(pa) < 0)
+    return 0;
+  if(*pte & PTE_W)
+    *pte = (*pte | PTE_EN_W) & ~PTE_W;
+  return pa;
+}
+
+// Map physical page pa copy-on-write at user address va,
+// in place of the writable page there, which is let go.
+// Returns 0, or -1 if va isn't such a page of the process's
+// memory below sz.
+int
+uvmremap(pagetable_t pagetable, uint64 sz, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va % PGSIZE != 0 || va >= sz || sz - va < PGSIZE)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & (PTE_W|PTE_EN_W)) == 0)
+    return -1;
+  if(kinc(pa) < 0)
+    return -1;
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | ((PTE_FLAGS(*pte) | PTE_EN_W) & ~PTE_W);
+  kfree((void*)old);
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
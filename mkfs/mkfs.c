@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog;     // Number of log blocks, header included
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirindex(uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -89,6 +90,15 @@ main(int argc, char *argv[])
   if(fsfd < 0)
     die(argv[1]);
 
+  // the log takes about 1/16th of the disk, but no more
+  // than the kernel can hold, plus its header block.
+  nlog = FSSIZE/16;
+  if(nlog > LOGSIZE)
+    nlog = LOGSIZE;
+  if(nlog < MAXOPBLOCKS*2)
+    nlog = MAXOPBLOCKS*2;
+  nlog += 1;
+
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
@@ -166,6 +176,7 @@ main(int argc, char *argv[])
   off = ((off/BSIZE) + 1) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
+  dirindex(rootino);
 
   balloc(freeblock);
 
@@ -227,6 +238,8 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  if(type == T_FILE)
+    din.flags = xint(I_INLINE | (EXTENTFILES ? I_EXTENT : 0));
   winode(inum, &din);
   return inum;
 }
@@ -249,6 +262,79 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of the extent-mapped
+// inode din, which is at most one past its last block.
+// mkfs writes each file in one go, so one run is plenty.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent *e = (struct extent*)din->addrs;
+  uint lbn = 0;
+  int i;
+
+  for(i = 0; i < NIEXTENT && xint(e[i].len) != 0; i++){
+    if(fbn < lbn + xint(e[i].len))
+      return xint(e[i].start) + fbn - lbn;
+    lbn += xint(e[i].len);
+  }
+  assert(fbn == lbn);
+  if(i > 0 && xint(e[i-1].start) + xint(e[i-1].len) == freeblock){
+    e[i-1].len = xint(xint(e[i-1].len) + 1);
+  } else {
+    assert(i < NIEXTENT);
+    e[i].start = xint(freeblock);
+    e[i].len = xint(1);
+  }
+  return freeblock++;
+}
+
+// Return the block holding block fbn of the block-mapped
+// inode din, allocating it and any missing indirect blocks.
+uint
+imap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint bn, span, x, i;
+  int level;
+
+  bn = fbn - NDIRECT;
+  for(level = 1, span = NINDIRECT; bn >= span; level++, span *= NINDIRECT){
+    assert(level < NLEVEL);
+    bn -= span;
+  }
+  if(xint(din->addrs[NDIRECT+level-1]) == 0){
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT+level-1]);
+  while(span > 1){
+    span /= NINDIRECT;
+    i = (bn / span) % NINDIRECT;
+    rsect(x, (char*)indirect);
+    if(indirect[i] == 0){
+      indirect[i] = xint(freeblock++);
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[i]);
+  }
+  return x;
+}
+
+// Return the block holding block fbn of inode din,
+// which is at most one past its last block.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  assert(fbn < MAXFILE);
+  if(xint(din->flags) & I_EXTENT)
+    return emap(din, fbn);
+  if(fbn >= NDIRECT)
+    return imap(din, fbn);
+  if(xint(din->addrs[fbn]) == 0){
+    din->addrs[fbn] = xint(freeblock++);
+  }
+  return xint(din->addrs[fbn]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,31 +342,30 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  if(xint(din.flags) & I_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, (char*)din.addrs + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // too big to stay inline: move what's there to a block.
+    bcopy(din.addrs, buf, off);
+    bzero(din.addrs, sizeof(din.addrs));
+    din.flags = xint(xint(din.flags) & ~I_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,6 +378,81 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+int
+dircmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// If directory inum has outgrown its first block, rewrite it
+// as an indexed directory (see struct dxentry), with its names
+// sorted by hash and each block left a quarter empty.
+void
+dirindex(uint inum)
+{
+  struct dinode din;
+  struct dirent *de, blk[DPB];
+  struct dxentry *dx;
+  uint n, nde, fbn, i, j, nblk;
+
+  rinode(inum, &din);
+  n = xint(din.size) / sizeof(struct dirent);
+  if(n <= DPB)
+    return;
+  de = malloc(n * sizeof(struct dirent));
+  for(fbn = 0; fbn * DPB < n; fbn++)
+    rsect(bmap(&din, fbn), (char*)&de[fbn * DPB]);
+
+  // de[0] and de[1] are "." and "..".
+  nde = 2;
+  for(i = 2; i < n; i++)
+    if(de[i].inum != 0)
+      de[nde++] = de[i];
+  qsort(de + 2, nde - 2, sizeof(struct dirent), dircmp);
+
+  // index: a new block starts when one is 3/4 full,
+  // but never between two names with the same hash.
+  bzero(blk, sizeof(blk));
+  blk[0] = de[0];
+  blk[1] = de[1];
+  dx = (struct dxentry*)&blk[2];
+  nblk = 0;
+  for(i = 2; i < nde; i = j){
+    if(nblk == NDXENTRY){
+      free(de);
+      return;
+    }
+    dx[nblk].hash = nblk == 0 ? 0 : xint(dirhash(de[i].name));
+    dx[nblk].blk = xint(nblk + 1);
+    nblk++;
+    for(j = i + 1; j < nde; j++)
+      if(j - i >= DPB*3/4 &&
+         dirhash(de[j].name) != dirhash(de[j-1].name))
+        break;
+    assert(j - i <= DPB);
+  }
+  dx[0].count = xshort(nblk);
+
+  din.size = xint(0);
+  din.flags = xint(xint(din.flags) | I_DIRINDEX);
+  winode(inum, &din);
+  iappend(inum, blk, sizeof(blk));
+  for(i = 2; i < nde; i = j){
+    bzero(blk, sizeof(blk));
+    for(j = i; j < nde; j++){
+      if(j - i >= DPB*3/4 &&
+         dirhash(de[j].name) != dirhash(de[j-1].name))
+        break;
+      blk[j - i] = de[j];
+    }
+    iappend(inum, blk, sizeof(blk));
+  }
+  free(de);
+}
+
 void
 die(const char *s)
 {
@@ -10,6 +10,13 @@ cat(int fd)
 {
   int n;
 
+  // between a file and a pipe, the kernel can move the data
+  // itself; otherwise splice() fails and it's copied here.
+  while((n = splice(fd, 1, 8*sizeof(buf))) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
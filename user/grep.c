@@ -5,32 +5,21 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[1024];
+struct rbuf in;
+char line[1024];
 int match(char*, char*);
 
 void
 grep(char *pattern, int fd)
 {
-  int n, m;
-  char *p, *q;
+  int n;
 
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
-    }
+  rbinit(&in, fd);
+  while((n = readline(&in, line, sizeof(line))) > 0){
+    if(line[n-1] == '\n')
+      line[n-1] = 0;
+    if(match(pattern, line))
+      printf("%s\n", line);
   }
 }
 
@@ -39,6 +28,7 @@ main(int argc, char *argv[])
 {
   int fd, i;
   char *pattern;
+  struct stat st;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
@@ -46,19 +36,29 @@ main(int argc, char *argv[])
   }
   pattern = argv[1];
 
+  // show matches a line at a time on the console,
+  // but batch them up when they go to a file or pipe.
+  if(fstat(1, &st) == 0 && st.type == T_DEVICE)
+    setbuf(1, PBUF_LINE);
+  else
+    setbuf(1, PBUF_FULL);
+
   if(argc <= 2){
     grep(pattern, 0);
+    fflush(1);
     exit(0);
   }
 
   for(i = 2; i < argc; i++){
     if((fd = open(argv[i], O_RDONLY)) < 0){
       printf("grep: cannot open %s\n", argv[i]);
+      fflush(1);
       exit(1);
     }
     grep(pattern, fd);
     close(fd);
   }
+  fflush(1);
   exit(0);
 }
 
@@ -77,11 +77,14 @@ main(int argc, char *argv[])
 {
   int i;
 
+  setbuf(1, PBUF_FULL);
   if(argc < 2){
     ls(".");
+    fflush(1);
     exit(0);
   }
   for(i=1; i<argc; i++)
     ls(argv[i]);
+  fflush(1);
   exit(0);
 }
@@ -6,14 +6,41 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output buffers for file descriptors 0 through NOBUF-1.
+// When a buffer is written out depends on its mode (see
+// setbuf()); output to other descriptors is written out at
+// the end of each printf.
+#define NOBUF 3
+#define OBUFSIZE 512
+
+struct obuf {
+  int fd;
+  int mode;   // PBUF_CALL, PBUF_LINE or PBUF_FULL
+  int n;      // bytes waiting in buf
+  char buf[OBUFSIZE];
+};
+
+static struct obuf obufs[NOBUF];
+static struct obuf other;   // for descriptors NOBUF and up
+
+static void
+flush(struct obuf *b)
+{
+  if(b->n > 0)
+    write(b->fd, b->buf, b->n);
+  b->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct obuf *b, char c)
 {
-  write(fd, &c, 1);
+  b->buf[b->n++] = c;
+  if(b->n == OBUFSIZE || (c == '\n' && b->mode == PBUF_LINE))
+    flush(b);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct obuf *b, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,25 +62,32 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(b, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct obuf *b, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(b, '0');
+  putc(b, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(b, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  struct obuf *b;
   char *s;
   int c, i, state;
 
+  if(fd >= 0 && fd < NOBUF)
+    b = &obufs[fd];
+  else
+    b = &other;
+  b->fd = fd;
+
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,37 +95,39 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(b, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(b, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(b, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(b, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(b, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(b, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(b, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(b, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(b, '%');
+        putc(b, c);
       }
       state = 0;
     }
   }
+  if(b->mode == PBUF_CALL)
+    flush(b);
 }
 
 void
@@ -111,3 +147,28 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+// Write out whatever printf has buffered for fd.
+void
+fflush(int fd)
+{
+  if(fd >= 0 && fd < NOBUF){
+    obufs[fd].fd = fd;
+    flush(&obufs[fd]);
+  }
+}
+
+// Choose when printf output to fd is written out: at the end
+// of each call (PBUF_CALL, the default), at each newline
+// (PBUF_LINE), or only when the buffer fills (PBUF_FULL).
+// A program that buffers more than a call's worth must
+// fflush() before it exits, forks, or write()s to fd itself.
+int
+setbuf(int fd, int mode)
+{
+  if(fd < 0 || fd >= NOBUF || mode < PBUF_CALL || mode > PBUF_FULL)
+    return -1;
+  fflush(fd);
+  obufs[fd].mode = mode;
+  return 0;
+}
@@ -1,6 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 //
@@ -63,15 +65,90 @@ strchr(const char *s, char c)
   return 0;
 }
 
+// Buffered input. A struct rbuf collects what its file
+// descriptor returns RBUFSIZE bytes at a time, so that getc()
+// and readline() make a system call only when it runs dry.
+
+void
+rbinit(struct rbuf *rb, int fd)
+{
+  rb->fd = fd;
+  rb->r = rb->n = 0;
+}
+
+// Read more into rb if it has nothing left. Returns the
+// number of bytes waiting, 0 at end of file, -1 on error.
+static int
+rbfill(struct rbuf *rb)
+{
+  if(rb->r < rb->n)
+    return rb->n - rb->r;
+  rb->r = 0;
+  rb->n = read(rb->fd, rb->buf, sizeof(rb->buf));
+  return rb->n;
+}
+
+// Next byte from rb, or -1 at end of file or on error.
+int
+getc(struct rbuf *rb)
+{
+  if(rbfill(rb) <= 0)
+    return -1;
+  return (uchar)rb->buf[rb->r++];
+}
+
+// Copy the next line from rb, newline included, into buf and
+// NUL-terminate it. A line that won't fit in max-1 bytes is
+// returned in pieces. Returns the line's length, 0 at end of
+// file, or -1 if an error comes before any data.
+int
+readline(struct rbuf *rb, char *buf, int max)
+{
+  int i, m, n;
+
+  i = 0;
+  while(i+1 < max){
+    if((n = rbfill(rb)) <= 0){
+      if(n < 0 && i == 0)
+        return -1;
+      break;
+    }
+    for(m = 0; m < n && i+m+1 < max; )
+      if(rb->buf[rb->r + m++] == '\n')
+        break;
+    memmove(buf+i, rb->buf + rb->r, m);
+    rb->r += m;
+    i += m;
+    if(buf[i-1] == '\n')
+      break;
+  }
+  if(max > 0)
+    buf[i] = '\0';
+  return i;
+}
+
+static struct rbuf in;  // fd 0
+
+// Read a line from fd 0. Only a device (the console), which
+// never returns more than a line per read(), is read through
+// a buffer. Reading a file or pipe ahead would take input away
+// from whoever reads fd 0 next, such as a child, so that is
+// read a byte at a time. Bytes already buffered come first.
 char*
 gets(char *buf, int max)
 {
-  int i, cc;
-  char c;
+  int i, c;
+  char b;
+  struct stat st;
+  int dev;
 
+  dev = in.r < in.n || (fstat(0, &st) == 0 && st.type == T_DEVICE);
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
+    if(dev)
+      c = getc(&in);
+    else
+      c = read(0, &b, 1) == 1 ? b : -1;
+    if(c < 0)
       break;
     buf[i++] = c;
     if(c == '\n' || c == '\r')
@@ -145,3 +222,33 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// The kernel keeps a few values where user programs can read
+// them without a system call; see memlayout.h.
+
+int
+ugetpid(void)
+{
+  return ((struct usyscall*)USYSCALL)->pid;
+}
+
+uint
+uuptime(void)
+{
+  return ((volatile struct ukdata*)UKDATA)->ticks;
+}
+
+// time CSR counts since boot, and how many make up a tick.
+uint64
+ucycles(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+uint64
+utickcycles(void)
+{
+  return ((struct ukdata*)UKDATA)->tickcycles;
+}
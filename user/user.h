@@ -1,4 +1,6 @@
 struct stat;
+struct iovec;
+struct ioring;
 
 // system calls
 int fork(void);
@@ -22,16 +24,42 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int vmsplice(int, const void*, int);
+int pread(int, void*, int, uint);
+int pwrite(int, const void*, int, uint);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+struct ioring* ioring_setup(void);
+int ioring_enter(void);
+
+// printf.c
+#define PBUF_CALL 0  // write out at the end of each printf
+#define PBUF_LINE 1  // ... at each newline
+#define PBUF_FULL 2  // ... only when the buffer fills
+void fprintf(int, const char*, ...);
+void printf(const char*, ...);
+void fflush(int);
+int setbuf(int, int);
 
 // ulib.c
+#define RBUFSIZE 1024
+struct rbuf {
+  int fd;
+  int r;               // next byte to return is buf[r]
+  int n;               // bytes in buf, or -1 after a read error
+  char buf[RBUFSIZE];
+};
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void fprintf(int, const char*, ...);
-void printf(const char*, ...);
 char* gets(char*, int max);
+void rbinit(struct rbuf*, int);
+int getc(struct rbuf*);
+int readline(struct rbuf*, char*, int);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -39,3 +67,7 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int ugetpid(void);
+uint uuptime(void);
+uint64 ucycles(void);
+uint64 utickcycles(void);
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/ioring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -418,7 +419,46 @@ truncate3(char *s)
   unlink("truncfile");
   exit(xstatus);
 }
-  
+
+// a small file keeps its data in the inode; make sure
+// growing it a few bytes at a time past that keeps the data.
+void
+smallgrow(char *s)
+{
+  char buf[200];
+  int fd, i, n;
+
+  unlink("smallgrow");
+  fd = open("smallgrow", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i += 10){
+    memset(buf, 'a' + i/10, 10);
+    if(write(fd, buf, 10) != 10){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("smallgrow", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  if(n != sizeof(buf)){
+    printf("%s: read %d bytes, wanted %d\n", s, n, sizeof(buf));
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != 'a' + i/10){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("smallgrow");
+}
+
 
 // does chdir() call iput(p->cwd) in a transaction?
 void
@@ -575,10 +615,15 @@ writetest(char *s)
   }
 }
 
+// write a big file. it needs a double-indirect block in a
+// kernel built with make EXTENTFILES=0, which maps files with
+// indirect blocks; one that needs a triple-indirect block
+// won't fit on the disk.
 void
 writebig(char *s)
 {
   int i, fd, n;
+  enum { N = NDIRECT + NINDIRECT + 2*NINDIRECT };
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -586,7 +631,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < N; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +651,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != N){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -786,6 +831,449 @@ pipe1(char *s)
 }
 
 
+// grow a pipe's buffer, fill it without a reader,
+// and check that it won't shrink below what it holds.
+void
+pipesize(char *s)
+{
+  int fds[2], i, n, sz;
+  enum { SZ=20000 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if((sz = fcntl(fds[0], F_GETPIPE_SZ, 0)) != PGSIZE){
+    printf("%s: pipe size %d\n", s, sz);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, SZ) != 8*PGSIZE){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, SZ) != SZ){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, PGSIZE) != -1){
+    printf("%s: shrank a full pipe\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 5*PGSIZE) != 8*PGSIZE){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, SZ);
+  if((n = read(fds[0], buf, SZ)) != SZ){
+    printf("%s: read %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if((buf[i] & 0xff) != (i & 0xff)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// move a file's contents into a pipe and
+// from there into another file with splice().
+void
+splicetest(char *s)
+{
+  int fds[2], fd, i, n;
+  enum { SZ=3000 };
+
+  fd = open("splicein", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++)
+    buf[i] = i * 7;
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create splicein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  fd = open("splicein", O_RDONLY);
+  if((n = splice(fd, fds[1], SZ + 100)) != SZ){
+    printf("%s: splice into pipe returned %d\n", s, n);
+    exit(1);
+  }
+  if(splice(fd, fds[0], 10) != -1 || splice(fds[0], fds[1], 10) != -1){
+    printf("%s: bad splice succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  if((n = splice(fds[0], fd, SZ + 100)) != SZ){
+    printf("%s: splice out of pipe returned %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  close(fds[0]);
+  close(fds[1]);
+
+  memset(buf, 0, SZ);
+  fd = open("spliceout", O_RDONLY);
+  if(read(fd, buf, SZ + 100) != SZ){
+    printf("%s: spliceout has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != (char)(i * 7)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// vmsplice() whole pages into a pipe, change them,
+// and check that the reader gets them as they were.
+void
+vmsplicetest(char *s)
+{
+  int fds[2], i, n;
+  char *p, *a, *b;
+  enum { SZ=3*PGSIZE+100 };
+
+  p = sbrk(9*PGSIZE);
+  a = (char*)PGROUNDUP((uint64)p);
+  b = a + 4*PGSIZE;
+  for(i = 0; i < SZ; i++)
+    a[i] = i % 251;
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if((n = vmsplice(fds[1], a, SZ)) != SZ){
+    printf("%s: vmsplice returned %d\n", s, n);
+    exit(1);
+  }
+  memset(a, 0, SZ);
+  if((n = read(fds[0], b, SZ)) != SZ){
+    printf("%s: read %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++){
+    if(b[i] != i % 251){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  b[0] = 1;
+  if(a[0] != 0){
+    printf("%s: reader's write showed up in writer\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-9*PGSIZE);
+}
+
+// positioned and vectored reads and writes.
+void
+preadwrite(char *s)
+{
+  int fd, n, fds[2];
+  char a[8], b[8], c[16];
+  struct iovec iov[3];
+
+  unlink("prw");
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defgh";
+  iov[2].iov_len = 5;
+  if((n = writev(fd, iov, 3)) != 8){
+    printf("%s: writev returned %d\n", s, n);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 2) != 2 || pwrite(fd, "ij", 2, 8) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  // pread and pwrite leave the offset alone.
+  if(write(fd, "k", 1) != 1 || pread(fd, c, sizeof(c), 0) != 10 ||
+     memcmp(c, "abXYefghkj", 10) != 0){
+    printf("%s: pread got the wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("prw", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if((n = readv(fd, iov, 2)) != 10 || memcmp(a, "abXY", 4) != 0 ||
+     memcmp(b, "efghkj", 6) != 0){
+    printf("%s: readv returned %d\n", s, n);
+    exit(1);
+  }
+  if(readv(fd, iov, NIOV + 1) != -1 || pread(0, c, 1, 0) != -1){
+    printf("%s: bad readv or pread succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("prw");
+
+  // readv on a pipe returns what's there, rather than
+  // waiting to fill the second buffer.
+  if(pipe(fds) < 0 || write(fds[1], "abcdef", 6) != 6){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if((n = readv(fds[0], iov, 2)) != 6 || memcmp(a, "abcd", 4) != 0 ||
+     memcmp(b, "ef", 2) != 0){
+    printf("%s: pipe readv returned %d\n", s, n);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// queue system calls in an I/O ring
+// and make them with ioring_enter().
+void
+ioringtest(char *s)
+{
+  struct ioring *r;
+  struct iosqe *e;
+  struct stat st;
+  char b[8];
+  int fd, i;
+  static char *name = "ioring";
+
+  if((r = ioring_setup()) == 0 || r->sqhead != 0 || r->cqtail != 0){
+    printf("%s: ioring_setup failed\n", s);
+    exit(1);
+  }
+  unlink(name);
+  e = &r->sq[r->sqtail % NSQE];
+  e->op = SYS_open;
+  e->arg[0] = (uint64)name;
+  e->arg[1] = O_CREATE|O_RDWR;
+  e->data = 1;
+  r->sqtail++;
+  if(ioring_enter() != 1 || r->cqtail - r->cqhead != 1 ||
+     r->cq[r->cqhead % NCQE].data != 1 || (fd = r->cq[r->cqhead % NCQE].res) < 0){
+    printf("%s: ring open failed\n", s);
+    exit(1);
+  }
+  r->cqhead++;
+
+  uint64 args[5][4] = {
+    { fd, (uint64)"hello", 5 },
+    { fd, (uint64)b, 4, 1 },
+    { fd, (uint64)&st },
+    { fd },
+    { fd },
+  };
+  int ops[5] = { SYS_write, SYS_pread, SYS_fstat, SYS_close, SYS_close };
+  int want[5] = { 5, 4, 0, 0, -1 };
+  for(i = 0; i < 5; i++){
+    e = &r->sq[r->sqtail % NSQE];
+    e->op = ops[i];
+    memcpy(e->arg, args[i], sizeof(e->arg));
+    e->data = 100 + i;
+    r->sqtail++;
+  }
+  if(ioring_enter() != 5){
+    printf("%s: ioring_enter failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 5; i++, r->cqhead++){
+    struct iocqe *c = &r->cq[r->cqhead % NCQE];
+    if(c->data != 100 + i || c->res != want[i]){
+      printf("%s: op %d returned %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(memcmp(b, "ello", 4) != 0 || st.size != 5){
+    printf("%s: ring read the wrong data\n", s);
+    exit(1);
+  }
+  unlink(name);
+}
+
+// the kernel data pages agree with the system calls,
+// and user programs can't write them.
+void
+ukdatatest(char *s)
+{
+  int pid, xstatus;
+  uint t0, t1;
+
+  if(ugetpid() != getpid()){
+    printf("%s: ugetpid %d, getpid %d\n", s, ugetpid(), getpid());
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(ugetpid() == getpid() ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child's ugetpid wrong\n", s);
+    exit(1);
+  }
+
+  t0 = uptime();
+  t1 = uuptime();
+  if(t1 < t0 || t1 > uptime() || utickcycles() == 0 || ucycles() == 0){
+    printf("%s: uuptime %d, uptime %d\n", s, t1, t0);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *(int*)USYSCALL = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote a read-only page\n", s);
+    exit(1);
+  }
+}
+
+// printf holds output back in PBUF_FULL mode until fflush().
+void
+printfbuf(char *s)
+{
+  char *name = "printfbuf";
+  char buf[32];
+  struct stat st;
+  int pid, fd, xstatus;
+
+  unlink(name);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open(name, O_CREATE|O_RDWR) != 1)
+      exit(1);
+    if(setbuf(1, PBUF_FULL) < 0)
+      exit(2);
+    printf("%d ", 12);
+    printf("%s\n", "ab");
+    if(fstat(1, &st) < 0 || st.size != 0)
+      exit(3);
+    fflush(1);
+    if(fstat(1, &st) < 0 || st.size != 6)
+      exit(4);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child failed with %d\n", s, xstatus);
+    exit(1);
+  }
+  fd = open(name, O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 6 || memcmp(buf, "12 ab\n", 6) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(name);
+}
+
+// readline() splits lines across its buffer and the caller's.
+void
+readlinetest(char *s)
+{
+  static struct rbuf rb;
+  char *name = "readline";
+  char *want[] = { "ab\n", "cde", "f\n", "\n", "xyz" };
+  char line[4];
+  int fd, i;
+
+  unlink(name);
+  fd = open(name, O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "ab\ncdef\n\nxyz", 13) != 13){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(name, O_RDONLY);
+  rbinit(&rb, fd);
+  for(i = 0; i < 5; i++){
+    if(readline(&rb, line, sizeof(line)) != strlen(want[i]) ||
+       strcmp(line, want[i]) != 0){
+      printf("%s: line %d is \"%s\"\n", s, i, line);
+      exit(1);
+    }
+  }
+  if(readline(&rb, line, sizeof(line)) != 0 || getc(&rb) != -1){
+    printf("%s: read past end of file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink(name);
+}
+
+// one write big enough that committing it hands the disk
+// more requests than it has descriptors for, in one batch.
+void
+bigdispatch(char *s)
+{
+  int fd, i;
+  enum { N = BUFSZ / BSIZE };
+
+  for(i = 0; i < N; i++)
+    memset(buf + i*BSIZE, 'a' + i % 26, BSIZE);
+  unlink("bigdispatch");
+  fd = open("bigdispatch", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N*BSIZE) != N*BSIZE){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(buf, 0, BUFSZ);
+  fd = open("bigdispatch", O_RDONLY);
+  if(fd < 0 || read(fd, buf, N*BSIZE) != N*BSIZE){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(buf[i*BSIZE] != 'a' + i % 26 || buf[i*BSIZE + BSIZE-1] != 'a' + i % 26){
+      printf("%s: block %d is wrong\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("bigdispatch");
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -2584,6 +3072,7 @@ struct test {
   {truncate1, "truncate1"},
   {truncate2, "truncate2"},
   {truncate3, "truncate3"},
+  {smallgrow, "smallgrow"},
   {openiputtest, "openiput"},
   {exitiputtest, "exitiput"},
   {iputtest, "iput"},
@@ -2594,6 +3083,15 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {pipesize, "pipesize"},
+  {splicetest, "splice"},
+  {vmsplicetest, "vmsplice"},
+  {preadwrite, "preadwrite"},
+  {ioringtest, "ioring"},
+  {ukdatatest, "ukdata"},
+  {printfbuf, "printfbuf"},
+  {readlinetest, "readline"},
+  {bigdispatch, "bigdispatch"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
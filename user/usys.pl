@@ -36,3 +36,12 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("fcntl");
+entry("splice");
+entry("vmsplice");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("ioring_setup");
+entry("ioring_enter");
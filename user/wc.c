@@ -3,31 +3,31 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[512];
+struct rbuf in;
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
+  int ch;
   int l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+  rbinit(&in, fd);
+  while((ch = getc(&in)) >= 0){
+    c++;
+    if(ch == '\n')
+      l++;
+    if(strchr(" \r\t\n\v", ch))
+      inword = 0;
+    else if(!inword){
+      w++;
+      inword = 1;
     }
   }
-  if(n < 0){
+  if(in.n < 0){
     printf("wc: read error\n");
+    fflush(1);
     exit(1);
   }
   printf("%d %d %d %s\n", l, w, c, name);
@@ -38,18 +38,22 @@ main(int argc, char *argv[])
 {
   int fd, i;
 
+  setbuf(1, PBUF_FULL);
   if(argc <= 1){
     wc(0, "");
+    fflush(1);
     exit(0);
   }
 
   for(i = 1; i < argc; i++){
     if((fd = open(argv[i], O_RDONLY)) < 0){
       printf("wc: cannot open %s\n", argv[i]);
+      fflush(1);
       exit(1);
     }
     wc(fd, argv[i]);
     close(fd);
   }
+  fflush(1);
   exit(0);
 }